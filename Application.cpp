@@ -47,11 +47,21 @@ int main(int argc, char *argv[]) {
 Application::Application(char *infile) {
 	int i;
 	par = new Params();
-	srand (time(NULL));
 	par->setparams(infile);
+	rng.seed(par->SEED, RNG_APPLICATION, 0);
+	cout<<"Seed: "<<par->SEED<<endl;
 	log = new Log(par);
-	en = new EmulNet(par);
-	en1 = new EmulNet(par);
+	if ( par->TRANSPORT == UDP_TRANSPORT ) {
+		// Membership and KV traffic get disjoint port ranges
+		en = new UdpNet(par, par->UDP_BASE_PORT, 0, "membership");
+		en1 = new UdpNet(par, par->UDP_BASE_PORT + par->EN_GPSZ + 1, 1, "kv");
+	}
+	else {
+		en = new EmulNet(par, 0, "membership");
+		en1 = new EmulNet(par, 1, "kv");
+	}
+	en->setClassifier(MP1Node::trafficType, MP1Node::trafficTypeName);
+	en1->setClassifier(Message::trafficType, Message::trafficTypeName);
 	mp1 = (MP1Node **) malloc(par->EN_GPSZ * sizeof(MP1Node *));
 	mp2 = (MP2Node **) malloc(par->EN_GPSZ * sizeof(MP2Node *));
 
@@ -71,12 +81,24 @@ Application::Application(char *infile) {
 		log->LOG(&(mp2[i]->getMemberNode()->addr), "APP MP2");
 		delete addressOfMemberNode;
 	}
+
+	pool = NULL;
+	int threads = par->THREADS > 0 ? par->THREADS : (int)thread::hardware_concurrency();
+	// UdpNet keeps per-socket state that is not safe to share between threads
+	if ( threads > 1 && par->TRANSPORT != UDP_TRANSPORT ) {
+		pool = new WorkerPool(threads);
+		for ( i = 0; i < par->EN_GPSZ; i++ ) {
+			forwardOrder.push_back(*(int *)(mp1[i]->getMemberNode()->addr.addr));
+		}
+		reverseOrder.assign(forwardOrder.rbegin(), forwardOrder.rend());
+	}
 }
 
 /**
  * Destructor
  */
 Application::~Application() {
+	delete pool;
 	delete log;
 	delete en;
 	delete en1;
@@ -100,7 +122,6 @@ int Application::run()
 	int timeWhenAllNodesHaveJoined = 0;
 	// boolean indicating if all nodes have joined
 	bool allNodesJoined = false;
-	srand(time(NULL));
 
 	// As time runs along
 	for( par->globaltime = 0; par->globaltime < TOTAL_RUNNING_TIME; ++par->globaltime ) {
@@ -124,6 +145,9 @@ int Application::run()
 		//fail();
 	}
 
+	reportQuorumStats();
+	reportReplicas();
+
 	// Clean up
 	en->ENcleanup();
 	en1->ENcleanup();
@@ -143,6 +167,11 @@ int Application::run()
 void Application::mp1Run() {
 	int i;
 
+	if ( pool ) {
+		mp1RunParallel();
+		return;
+	}
+
 	// For all the nodes in the system
 	for( i = 0; i <= par->EN_GPSZ-1; i++) {
 
@@ -186,40 +215,136 @@ void Application::mp1Run() {
 }
 
 /**
- * FUNCTION NAME: mp2Run
+ * FUNCTION NAME: holdOutput
  *
- * DESCRIPTION: This function performs all the key value store related functionalities
- * 				including:
- * 				1) Ring operations
- * 				2) CRUD operations
+ * DESCRIPTION: Keep the sends and log lines of every node aside while the pool runs a phase
  */
-void Application::mp2Run() {
+void Application::holdOutput(EmulNet *net) {
+	net->ENhold();
+	log->hold(par->EN_GPSZ);
+}
+
+/**
+ * FUNCTION NAME: releaseOutput
+ *
+ * DESCRIPTION: Hand what the nodes produced in a phase to the network and the log,
+ * 				node by node in the order the serial loop would have run them
+ */
+void Application::releaseOutput(EmulNet *net, vector<int> &order) {
+	net->ENrelease(order);
+	log->release(order);
+}
+
+/**
+ * FUNCTION NAME: mp1RunParallel
+ *
+ * DESCRIPTION: mp1Run on the worker pool. Every phase ends in a barrier that releases
+ * 				the held output in serial loop order, so a run is repeatable for a given
+ * 				THREADS value. It may differ from the output of the serial loops, since
+ * 				held sends reach the network only at the barrier.
+ */
+void Application::mp1RunParallel() {
 	int i;
-	cout << par->getcurrtime()  << endl;
-	// For all the nodes in the system
-	for( i = 0; i <= par->EN_GPSZ-1; i++) {
 
-		/*
-		 * 1) Update the ring
-		 * 2) Receive messages from the network and queue them in the KV store queue
-		 */
+	// Due messages are moved into the inboxes before any thread reads one
+	en->deliverDue();
+	holdOutput(en);
+	pool->parallelFor(par->EN_GPSZ, [this](int i) {
+		if( par->getcurrtime() > (int)(par->STEP_RATE*i) && !(mp1[i]->getMemberNode()->bFailed) ) {
+			mp1[i]->recvLoop();
+		}
+	});
+	releaseOutput(en, forwardOrder);
+
+	holdOutput(en);
+	// Introductions print and update nodeCount, so they stay on this thread
+	for( i = par->EN_GPSZ - 1; i >= 0; i-- ) {
+		if( par->getcurrtime() == (int)(par->STEP_RATE*i) ) {
+			mp1[i]->nodeStart(JOINADDR, par->PORTNUM);
+			cout<<i<<"-th introduced node is assigned with the address: "<<mp1[i]->getMemberNode()->addr.getAddress() << endl;
+			nodeCount += i;
+		}
+	}
+	pool->parallelFor(par->EN_GPSZ, [this](int i) {
+		if( par->getcurrtime() > (int)(par->STEP_RATE*i) && !(mp1[i]->getMemberNode()->bFailed) ) {
+			mp1[i]->nodeLoop();
+			#ifdef DEBUGLOG
+			if( (i == 0) && (par->globaltime % 500 == 0) ) {
+				log->LOG(&mp1[i]->getMemberNode()->addr, "@@time=%d", par->getcurrtime());
+			}
+			#endif
+		}
+	});
+	releaseOutput(en, reverseOrder);
+}
+
+/**
+ * FUNCTION NAME: mp2RunParallel
+ *
+ * DESCRIPTION: The node loops of mp2Run on the worker pool, see mp1RunParallel
+ */
+void Application::mp2RunParallel() {
+	en1->deliverDue();
+	holdOutput(en1);
+	pool->parallelFor(par->EN_GPSZ, [this](int i) {
 		if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
 			if ( mp2[i]->getMemberNode()->inited && mp2[i]->getMemberNode()->inGroup ) {
-				// Step 1
 				mp2[i]->updateRing();
 			}
-			// Step 2
 			mp2[i]->recvLoop();
 		}
-	}
+	});
+	releaseOutput(en1, forwardOrder);
 
-	/**
-	 * Handle messages from the queue and update the DHT
-	 */
-	for ( i = par->EN_GPSZ-1; i >= 0; i-- ) {
+	holdOutput(en1);
+	pool->parallelFor(par->EN_GPSZ, [this](int i) {
 		if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
 			mp2[i]->checkMessages();
 		}
+	});
+	releaseOutput(en1, reverseOrder);
+}
+
+/**
+ * FUNCTION NAME: mp2Run
+ *
+ * DESCRIPTION: This function performs all the key value store related functionalities
+ * 				including:
+ * 				1) Ring operations
+ * 				2) CRUD operations
+ */
+void Application::mp2Run() {
+	int i;
+	cout << par->getcurrtime()  << endl;
+	if ( pool ) {
+		mp2RunParallel();
+	}
+	else {
+		// For all the nodes in the system
+		for( i = 0; i <= par->EN_GPSZ-1; i++) {
+
+			/*
+			 * 1) Update the ring
+			 * 2) Receive messages from the network and queue them in the KV store queue
+			 */
+			if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
+				if ( mp2[i]->getMemberNode()->inited && mp2[i]->getMemberNode()->inGroup ) {
+					// Step 1
+					mp2[i]->updateRing();
+				}
+				// Step 2
+				mp2[i]->recvLoop();
+			}
+		}
+
+		/**
+		 * Handle messages from the queue and update the DHT
+		 */
+		for ( i = par->EN_GPSZ-1; i >= 0; i-- ) {
+			if ( par->getcurrtime() > (int)(par->STEP_RATE*i) && !mp2[i]->getMemberNode()->bFailed ) {
+				mp2[i]->checkMessages();
+			}
+		}
 	}
 
 	/**
@@ -233,11 +358,15 @@ void Application::mp2Run() {
 	 * Test CRUD operations
 	 */
 	if ( par->getcurrtime() >= TEST_TIME ) {
+		if ( par->getcurrtime() == TEST_TIME ) {
+			reportKeyBalance();
+		}
+
 		/**************
 		 * CREATE TEST
 		 **************/
 		/**
-		 * TEST 1: Checks if there are RF * NUMBER_OF_INSERTS CREATE SUCCESS message are in the log
+		 * TEST 1: Checks if there are RF * INSERTS CREATE SUCCESS message are in the log
 		 *
 		 */
 		if ( par->getcurrtime() == TEST_TIME && CREATE_TEST == par->CRUDTEST ) {
@@ -248,8 +377,8 @@ void Application::mp2Run() {
 		 * DELETE TESTS
 		 ***************/
 		/**
-		 * TEST 1: NUMBER_OF_INSERTS/2 Key Value pair are deleted.
-		 * 		   Check whether RF * NUMBER_OF_INSERTS/2 DELETE SUCCESS message are in the log
+		 * TEST 1: INSERTS/2 Key Value pair are deleted.
+		 * 		   Check whether RF * INSERTS/2 DELETE SUCCESS message are in the log
 		 * TEST 2: Delete a non-existent key. Check for a DELETE FAIL message in the lgo
 		 *
 		 */
@@ -347,14 +476,14 @@ void Application::fail() {
 	}
 
 	if( par->SINGLE_FAILURE && par->getcurrtime() == 100 ) {
-		removed = (rand() % par->EN_GPSZ);
+		removed = rng.below(par->EN_GPSZ);
 		#ifdef DEBUGLOG
 		log->LOG(&mp1[removed]->getMemberNode()->addr, "Node failed at time=%d", par->getcurrtime());
 		#endif
 		mp1[removed]->getMemberNode()->bFailed = true;
 	}
 	else if( par->getcurrtime() == 100 ) {
-		removed = rand() % par->EN_GPSZ/2;
+		removed = rng.below(par->EN_GPSZ)/2;
 		for ( i = removed; i < removed + par->EN_GPSZ/2; i++ ) {
 			#ifdef DEBUGLOG
 			log->LOG(&mp1[i]->getMemberNode()->addr, "Node failed at time = %d", par->getcurrtime());
@@ -392,7 +521,7 @@ Address Application::getjoinaddr(void){
 int Application::findARandomNodeThatIsAlive() {
 	int number;
 	do {
-		number = (rand()%par->EN_GPSZ);
+		number = rng.below(par->EN_GPSZ);
 	}while (mp2[number]->getMemberNode()->bFailed);
 	return number;
 }
@@ -400,20 +529,22 @@ int Application::findARandomNodeThatIsAlive() {
 /**
  * FUNCTION NAME: initTestKVPairs
  *
- * DESCRIPTION: Init NUMBER_OF_INSERTS test KV pairs in the map
+ * DESCRIPTION: Init INSERTS test KV pairs in the map, with values of at least VALUE_SIZE bytes
  */
 void Application::initTestKVPairs() {
-	srand(time(NULL));
 	int i;
 	string key;
 	key.clear();
 	testKVPairs.clear();
 	int alphanumLen = sizeof(alphanum) - 1;
-	while ( testKVPairs.size() != NUMBER_OF_INSERTS ) {
+	while ( testKVPairs.size() != (size_t)par->INSERTS ) {
 		for ( i = 0; i < KEY_LENGTH; i++ ) {
-			key.push_back(alphanum[rand()%alphanumLen]);
+			key.push_back(alphanum[rng.below(alphanumLen)]);
+		}
+		string value = "value" + to_string(rng.below(par->INSERTS));
+		if ( value.size() < (size_t)par->VALUE_SIZE ) {
+			value.append(par->VALUE_SIZE - value.size(), '.');
 		}
-		string value = "value" + to_string(rand()%NUMBER_OF_INSERTS);
 		testKVPairs[key] = value;
 		key.clear();
 	}
@@ -443,6 +574,138 @@ void Application::insertTestKVPairs() {
 	cout<<endl<<"Sent " <<testKVPairs.size() <<" create messages to the ring"<<endl;
 }
 
+/**
+ * FUNCTION NAME: reportKeyBalance
+ *
+ * DESCRIPTION: Write how evenly the stored keys are spread over the live nodes to
+ * 				stats.log, as the ratio of the largest count to the mean
+ */
+void Application::reportKeyBalance() {
+	unsigned long total = 0, most = 0;
+	int alive = 0, fullest = 0;
+
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		if ( mp2[i]->getMemberNode()->bFailed ) {
+			continue;
+		}
+		unsigned long keys = mp2[i]->keyCount();
+		total += keys;
+		if ( keys > most ) {
+			most = keys;
+			fullest = i;
+		}
+		alive++;
+	}
+	if ( alive == 0 ) {
+		return;
+	}
+	double mean = (double)total / alive;
+	double balance = total > 0 ? most / mean : 0.0;
+	log->LOG(&mp2[fullest]->getMemberNode()->addr, "#STATSLOG# vnodes=%d nodes=%d keys=%lu max=%lu mean=%.2f max/mean=%.2f",
+			par->VNODES, alive, total, most, mean, balance);
+	cout<<endl<<"Keys per node with "<<par->VNODES<<" virtual nodes: max "<<most<<", mean "<<mean<<", max/mean "<<balance<<endl;
+
+	// Memory of the storage engines, for comparing them under the same workload
+	const char *engine = mp2[fullest]->storageName();
+	size_t bytes = 0;
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		if ( !mp2[i]->getMemberNode()->bFailed ) {
+			bytes += mp2[i]->storageBytes();
+		}
+	}
+	double perKey = total > 0 ? (double)bytes / total : 0.0;
+	log->LOG(&mp2[fullest]->getMemberNode()->addr, "#STATSLOG# storage=%s keys=%lu bytes=%zu bytes/key=%.1f",
+			engine, total, bytes, perKey);
+	cout<<"Storage engine "<<engine<<": "<<bytes<<" bytes, "<<perKey<<" per key"<<endl;
+
+	// Group commit of the write-ahead logs: records logged per write and per sync
+	if ( par->WAL == WAL_OFF ) {
+		return;
+	}
+	long long records = 0, commits = 0, syncs = 0, snapshots = 0;
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		WriteAheadLog &wal = mp2[i]->getWal();
+		records += wal.records;
+		commits += wal.commits;
+		syncs += wal.syncs;
+		snapshots += mp2[i]->getSnapshots();
+	}
+	log->LOG(&mp2[fullest]->getMemberNode()->addr, "#STATSLOG# wal records=%lld writes=%lld syncs=%lld records/write=%.2f snapshots=%lld",
+			records, commits, syncs, commits > 0 ? (double)records / commits : 0.0, snapshots);
+}
+
+/**
+ * FUNCTION NAME: reportQuorumStats
+ *
+ * DESCRIPTION: Write the outcomes and latencies of the client requests of every quorum
+ * 				level that was used to stats.log, summed over all coordinators
+ */
+void Application::reportQuorumStats() {
+	for ( int read = 0; read < 2; read++ ) {
+		for ( int n = 1; n <= MAX_REPLICAS; n++ ) {
+			for ( int needed = 1; needed <= n; needed++ ) {
+				quorum_stat total = {0, 0, 0, 0};
+				for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+					quorum_stat &stat = mp2[i]->getQuorumStat(read, n, needed);
+					total.success += stat.success;
+					total.fail += stat.fail;
+					total.latency += stat.latency;
+					total.maxLatency = max(total.maxLatency, stat.maxLatency);
+				}
+				if ( total.success + total.fail == 0 ) {
+					continue;
+				}
+				double mean = total.success ? (double)total.latency / total.success : 0;
+				log->LOG(&mp2[0]->getMemberNode()->addr, "#STATSLOG# quorum N=%d %c=%d ops=%lld success=%lld fail=%lld latency mean=%.2f max=%lld",
+						n, read ? 'R' : 'W', needed, total.success + total.fail, total.success, total.fail, mean, total.maxLatency);
+				cout<<"Quorum N="<<n<<" "<<(read ? 'R' : 'W')<<"="<<needed<<": "<<total.success<<" succeeded, "<<total.fail
+						<<" failed, mean latency "<<mean<<" ticks"<<endl;
+			}
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: reportReplicas
+ *
+ * DESCRIPTION: Write to stats.log how the test keys are replicated on the live nodes at the
+ * 				end of the run: the keys still stored, those with fewer copies than their N,
+ * 				and the copies whose value differs from the inserted one
+ */
+void Application::reportReplicas() {
+	int keys = 0, under = 0, stale = 0, alive = -1;
+
+	for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+		if ( !mp2[i]->getMemberNode()->bFailed ) {
+			alive = i;
+		}
+	}
+	if ( alive < 0 ) {
+		return;
+	}
+	for ( map<string, string>::iterator it = testKVPairs.begin(); it != testKVPairs.end(); ++it ) {
+		int copies = 0;
+		for ( int i = 0; i < par->EN_GPSZ; i++ ) {
+			if ( mp2[i]->getMemberNode()->bFailed ) {
+				continue;
+			}
+			const string *value = mp2[i]->readKey(it->first);
+			if ( value != NULL ) {
+				copies++;
+				stale += *value != it->second;
+			}
+		}
+		// Deleted keys are not counted
+		if ( copies == 0 ) {
+			continue;
+		}
+		keys++;
+		under += copies < par->quorumFor(it->first).n;
+	}
+	log->LOG(&mp2[alive]->getMemberNode()->addr, "#STATSLOG# replicas keys=%d under=%d stale=%d", keys, under, stale);
+	cout<<"Test keys stored: "<<keys<<", with too few replicas: "<<under<<", stale copies: "<<stale<<endl;
+}
+
 /**
  * FUNCTION NAME: deleteTest
  *
@@ -490,7 +753,7 @@ void Application::readTest() {
 	// This key is used for all read tests
 	map<string, string>::iterator it = testKVPairs.begin();
 	int number;
-	vector<Node> replicas;
+	ReplicaSet replicas;
 	int replicaIdToFail = TERTIARY;
 	int nodeToFail;
 	bool failedOneNode = false;
@@ -735,7 +998,7 @@ void Application::updateTest() {
 	it++;
 	string newValue = "newValue";
 	int number;
-	vector<Node> replicas;
+	ReplicaSet replicas;
 	int replicaIdToFail = TERTIARY;
 	int nodeToFail;
 	bool failedOneNode = false;
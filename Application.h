@@ -13,7 +13,9 @@
 #include "Params.h"
 #include "Member.h"
 #include "EmulNet.h"
+#include "UdpNet.h"
 #include "Queue.h"
+#include "WorkerPool.h"
 #include "MP2Node.h"
 #include "Node.h"
 #include "common.h"
@@ -38,7 +40,6 @@ static const char alphanum[] =
 #define FIRST_FAIL_TIME 25
 #define LAST_FAIL_TIME 10
 #define RF 3
-#define NUMBER_OF_INSERTS 100
 #define KEY_LENGTH 5
 
 /**
@@ -58,6 +59,17 @@ private:
 	MP2Node **mp2;
 	Params *par;
 	map<string, string> testKVPairs;
+	// Chooses test keys and failed nodes
+	Random rng;
+	// Runs the node phases of a tick in parallel, NULL for the serial loops
+	WorkerPool *pool;
+	// Node ids in the order of the ascending and descending serial loops
+	vector<int> forwardOrder;
+	vector<int> reverseOrder;
+	void holdOutput(EmulNet *net);
+	void releaseOutput(EmulNet *net, vector<int> &order);
+	void mp1RunParallel();
+	void mp2RunParallel();
 public:
 	Application(char *);
 	virtual ~Application();
@@ -68,6 +80,9 @@ public:
 	void mp2Run();
 	void fail();
 	void insertTestKVPairs();
+	void reportKeyBalance();
+	void reportQuorumStats();
+	void reportReplicas();
 	int findARandomNodeThatIsAlive();
 	void deleteTest();
 	void readTest();
@@ -0,0 +1,61 @@
+/**********************************
+ * FILE NAME: Crc.cpp
+ *
+ * DESCRIPTION: Definition of crc32c
+ **********************************/
+
+#include "Crc.h"
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+/**
+ * FUNCTION NAME: crc32cTable
+ *
+ * DESCRIPTION: CRC of every byte value, built on first use
+ */
+#ifndef __SSE4_2__
+static const uint32_t *crc32cTable() {
+	static uint32_t table[256];
+	static bool built = [] {
+		for ( uint32_t b = 0; b < 256; b++ ) {
+			uint32_t c = b;
+			for ( int k = 0; k < 8; k++ ) {
+				c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+			}
+			table[b] = c;
+		}
+		return true;
+	}();
+	(void)built;
+	return table;
+}
+#endif
+
+/**
+ * FUNCTION NAME: crc32c
+ *
+ * DESCRIPTION: CRC-32C of size bytes at data, continuing from the CRC of the bytes before
+ * 				them, or starting from 0. The crc32 instruction is used when the build
+ * 				targets SSE4.2, a byte table otherwise. Both give the same result.
+ */
+uint32_t crc32c(const void *data, size_t size, uint32_t crc) {
+	const unsigned char *p = (const unsigned char *)data;
+	crc = ~crc;
+#ifdef __SSE4_2__
+	for ( ; size >= 8; size -= 8, p += 8 ) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc = (uint32_t)_mm_crc32_u64(crc, word);
+	}
+	for ( ; size > 0; size--, p++ ) {
+		crc = _mm_crc32_u8(crc, *p);
+	}
+#else
+	const uint32_t *table = crc32cTable();
+	for ( ; size > 0; size--, p++ ) {
+		crc = table[(crc ^ *p) & 0xff] ^ (crc >> 8);
+	}
+#endif
+	return ~crc;
+}
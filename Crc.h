@@ -0,0 +1,18 @@
+/**********************************
+ * FILE NAME: Crc.h
+ *
+ * DESCRIPTION: CRC-32C checksum of the records nodes write to disk, header file
+ **********************************/
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include "stdincludes.h"
+#include <stdint.h>
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82f63b78u
+
+uint32_t crc32c(const void *data, size_t size, uint32_t crc = 0);
+
+#endif /* _CRC_H_ */
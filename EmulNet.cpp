@@ -9,19 +9,20 @@
 /**
  * Constructor
  */
-EmulNet::EmulNet(Params *p)
+EmulNet::EmulNet(Params *p, int netId, const char *name)
 {
 	//trace.funcEntry("EmulNet::EmulNet");
-	int i,j;
 	par = p;
+	this->netId = netId;
+	this->name = name;
+	classify = NULL;
+	typeName = NULL;
 	emulnet.setNextId(1);
 	emulnet.settCurrBuffSize(0);
 	enInited=0;
-	for ( i = 0; i < MAX_NODES; i++ ) {
-		for ( j = 0; j < MAX_TIME; j++ ) {
-			sent_msgs[i][j] = 0;
-			recv_msgs[i][j] = 0;
-		}
+	holding = false;
+	for ( size_t i = 0; i < p->LINK_OVERRIDES.size(); i++ ) {
+		setLinkModel(p->LINK_OVERRIDES[i].src, p->LINK_OVERRIDES[i].dst, p->LINK_OVERRIDES[i].model);
 	}
 	//trace.funcExit("EmulNet::EmulNet", SUCCESS);
 }
@@ -30,39 +31,387 @@ EmulNet::EmulNet(Params *p)
  * Copy constructor
  */
 EmulNet::EmulNet(EmulNet &anotherEmulNet) {
-	int i, j;
 	this->par = anotherEmulNet.par;
+	this->netId = anotherEmulNet.netId;
+	this->name = anotherEmulNet.name;
+	this->classify = anotherEmulNet.classify;
+	this->typeName = anotherEmulNet.typeName;
+	this->typeStats = anotherEmulNet.typeStats;
+	this->linkStats = anotherEmulNet.linkStats;
+	this->rngs = anotherEmulNet.rngs;
 	this->enInited = anotherEmulNet.enInited;
-	for ( i = 0; i < MAX_NODES; i++ ) {
-		for ( j = 0; j < MAX_TIME; j++ ) {
-			this->sent_msgs[i][j] = anotherEmulNet.sent_msgs[i][j];
-			this->recv_msgs[i][j] = anotherEmulNet.recv_msgs[i][j];
-		}
-	}
+	this->holding = false;
+	this->counters = anotherEmulNet.counters;
 	this->emulnet = anotherEmulNet.emulnet;
+	this->linkModels = anotherEmulNet.linkModels;
 }
 
 /**
  * Assignment operator overloading
  */
 EmulNet& EmulNet::operator =(EmulNet &anotherEmulNet) {
-	int i, j;
 	this->par = anotherEmulNet.par;
+	this->netId = anotherEmulNet.netId;
+	this->name = anotherEmulNet.name;
+	this->classify = anotherEmulNet.classify;
+	this->typeName = anotherEmulNet.typeName;
+	this->typeStats = anotherEmulNet.typeStats;
+	this->linkStats = anotherEmulNet.linkStats;
+	this->rngs = anotherEmulNet.rngs;
 	this->enInited = anotherEmulNet.enInited;
-	for ( i = 0; i < MAX_NODES; i++ ) {
-		for ( j = 0; j < MAX_TIME; j++ ) {
-			this->sent_msgs[i][j] = anotherEmulNet.sent_msgs[i][j];
-			this->recv_msgs[i][j] = anotherEmulNet.recv_msgs[i][j];
-		}
-	}
+	this->counters = anotherEmulNet.counters;
 	this->emulnet = anotherEmulNet.emulnet;
+	this->linkModels = anotherEmulNet.linkModels;
 	return *this;
 }
 
 /**
  * Destructor
  */
-EmulNet::~EmulNet() {}
+EmulNet::~EmulNet() {
+	freeSlotPool();
+}
+
+/**
+ * FUNCTION NAME: allocSlot
+ *
+ * DESCRIPTION: Take an en_msg slot from the pool, allocating one only when the pool is empty.
+ * 				Every slot can hold the largest message ENsend accepts.
+ */
+en_msg *EmulNet::allocSlot() {
+	if ( freeSlots.empty() ) {
+		return (en_msg *)malloc(sizeof(en_msg) + par->MAX_MSG_SIZE);
+	}
+	en_msg *slot = freeSlots.back();
+	freeSlots.pop_back();
+	return slot;
+}
+
+/**
+ * FUNCTION NAME: releaseSlot
+ *
+ * DESCRIPTION: Return a delivered or discarded slot to the pool
+ */
+void EmulNet::releaseSlot(en_msg *slot) {
+	freeSlots.push_back(slot);
+}
+
+/**
+ * FUNCTION NAME: freeSlotPool
+ *
+ * DESCRIPTION: Release the memory held by the pool
+ */
+void EmulNet::freeSlotPool() {
+	for ( size_t i = 0; i < freeSlots.size(); i++ ) {
+		free(freeSlots[i]);
+	}
+	freeSlots.clear();
+}
+
+/**
+ * FUNCTION NAME: bucket
+ *
+ * DESCRIPTION: Return the bucket for the given tick, creating it if needed.
+ * 				Time only moves forward, so this is almost always the last bucket.
+ */
+tick_count& MsgCounter::bucket(int time) {
+	if ( ticks.empty() || ticks.back().time < time ) {
+		tick_count tc = {time, 0, 0, 0, 0};
+		ticks.push_back(tc);
+		return ticks.back();
+	}
+	if ( ticks.back().time == time ) {
+		return ticks.back();
+	}
+	vector<tick_count>::iterator it = ticks.begin();
+	while ( it->time < time ) {
+		++it;
+	}
+	if ( it->time != time ) {
+		tick_count tc = {time, 0, 0, 0, 0};
+		it = ticks.insert(it, tc);
+	}
+	return *it;
+}
+
+/**
+ * FUNCTION NAME: counterFor
+ *
+ * DESCRIPTION: Return the counters of node id. The table only grows as far as the
+ * 				largest node id that has actually sent or received.
+ */
+MsgCounter& EmulNet::counterFor(int id) {
+	if ( id >= (int)counters.size() ) {
+		counters.resize(id + 1);
+	}
+	return counters[id];
+}
+
+/**
+ * FUNCTION NAME: setClassifier
+ *
+ * DESCRIPTION: Let the protocol on this network name its message types for the traffic accounting
+ */
+void EmulNet::setClassifier(msg_classifier classify, msg_type_name typeName) {
+	this->classify = classify;
+	this->typeName = typeName;
+}
+
+/**
+ * FUNCTION NAME: typeStat
+ *
+ * DESCRIPTION: Return the traffic of the message type data belongs to
+ */
+traffic_stat& EmulNet::typeStat(const char *data, int size) {
+	int slot = (classify ? classify(data, size) : -1) + 1;
+	if ( slot < 0 ) {
+		slot = 0;
+	}
+	if ( slot >= (int)typeStats.size() ) {
+		traffic_stat none = {0, 0, 0, 0};
+		typeStats.resize(slot + 1, none);
+	}
+	return typeStats[slot];
+}
+
+/**
+ * FUNCTION NAME: typeLabel
+ *
+ * DESCRIPTION: Printable name of a message type
+ */
+string EmulNet::typeLabel(int type) {
+	if ( type < 0 ) {
+		return "unknown";
+	}
+	if ( typeName ) {
+		return typeName(type);
+	}
+	return to_string(type);
+}
+
+/**
+ * FUNCTION NAME: countSent
+ *
+ * DESCRIPTION: Account one message of size bytes accepted for sending from src to dst
+ */
+void EmulNet::countSent(int src, int dst, const char *data, int size) {
+	if ( src < 0 ) {
+		return;
+	}
+	counterFor(src).countSent(par->getcurrtime(), size);
+	traffic_stat &ts = typeStat(data, size);
+	ts.sent++;
+	ts.sentBytes += size;
+	traffic_stat &ls = linkStats[linkKey(src, dst)];
+	ls.sent++;
+	ls.sentBytes += size;
+}
+
+/**
+ * FUNCTION NAME: countRecv
+ *
+ * DESCRIPTION: Account one message of size bytes handed to dst
+ */
+void EmulNet::countRecv(int src, int dst, const char *data, int size) {
+	counterFor(dst).countRecv(par->getcurrtime(), size);
+	traffic_stat &ts = typeStat(data, size);
+	ts.recv++;
+	ts.recvBytes += size;
+	traffic_stat &ls = linkStats[linkKey(src, dst)];
+	ls.recv++;
+	ls.recvBytes += size;
+}
+
+/**
+ * FUNCTION NAME: rngFor
+ *
+ * DESCRIPTION: Return the generator of node id, seeding it on first use
+ */
+Random& EmulNet::rngFor(int id) {
+	if ( id < 0 ) {
+		id = 0;
+	}
+	while ( (int)rngs.size() <= id ) {
+		rngs.push_back(Random(par->SEED, RNG_NETWORK, ((uint64_t)netId << 32) | rngs.size()));
+	}
+	return rngs[id];
+}
+
+/**
+ * FUNCTION NAME: setLinkModel
+ *
+ * DESCRIPTION: Give the link from node src to node dst its own latency and bandwidth
+ */
+void EmulNet::setLinkModel(int src, int dst, link_model &model) {
+	linkModels[linkKey(src, dst)] = model;
+}
+
+/**
+ * FUNCTION NAME: sampleLatency
+ *
+ * DESCRIPTION: Draw a latency in whole ticks from model
+ */
+int EmulNet::sampleLatency(link_model &model, Random &rng) {
+	double ticks = 0;
+	double u1, u2;
+
+	switch ( model.type ) {
+		case FIXED_LATENCY:
+			ticks = model.a;
+			break;
+		case UNIFORM_LATENCY:
+			ticks = model.a + (model.b - model.a) * rng.uniform();
+			break;
+		case LOGNORMAL_LATENCY:
+			// Box-Muller, u1 kept away from 0 for the log
+			u1 = 1.0 - rng.uniform();
+			u2 = rng.uniform();
+			ticks = model.a * exp(model.b * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+			break;
+		default:
+			break;
+	}
+	return ticks > 0 ? (int)lround(ticks) : 0;
+}
+
+/**
+ * FUNCTION NAME: modelFor
+ *
+ * DESCRIPTION: Model of the link with the given linkKey
+ */
+link_model *EmulNet::modelFor(long long key) {
+	if ( !linkModels.empty() ) {
+		unordered_map<long long, link_model>::iterator it = linkModels.find(key);
+		if ( it != linkModels.end() ) {
+			return &it->second;
+		}
+	}
+	return &par->LINK_MODEL;
+}
+
+/**
+ * FUNCTION NAME: chargeLink
+ *
+ * DESCRIPTION: Queue size bytes on a bandwidth limited link
+ *
+ * RETURNS:
+ * ticks from now until the link has sent them
+ */
+int EmulNet::chargeLink(long long key, link_model &model, int size) {
+	double now = par->getcurrtime();
+	double &busy = linkBusy[key];
+	if ( busy < now ) {
+		busy = now;
+	}
+	busy += (double)size / model.bandwidth;
+	return (int)ceil(busy - now);
+}
+
+/**
+ * FUNCTION NAME: linkDelay
+ *
+ * DESCRIPTION: Ticks until a message of size bytes sent now from src arrives at dst.
+ * 				A bandwidth limited link sends one message at a time, so a message
+ * 				also waits for the ones queued on the link before it. latency, unless
+ * 				NULL, is set to the part of the delay that does not depend on the link load.
+ */
+int EmulNet::linkDelay(int src, int dst, int size, int *latency) {
+	long long key = linkKey(src, dst);
+	link_model *model = modelFor(key);
+
+	if ( latency != NULL ) {
+		*latency = 0;
+	}
+	if ( model->type == NO_LATENCY && model->bandwidth <= 0 ) {
+		return 0;
+	}
+
+	int delay = sampleLatency(*model, rngFor(src));
+	if ( latency != NULL ) {
+		*latency = delay;
+	}
+	if ( model->bandwidth > 0 ) {
+		delay += chargeLink(key, *model, size);
+	}
+	return delay;
+}
+
+/**
+ * FUNCTION NAME: deliverDue
+ *
+ * DESCRIPTION: Move the delayed messages whose tick has come into their inboxes
+ */
+void EmulNet::deliverDue() {
+	if ( wheel.size() == 0 || wheel.getNow() >= par->getcurrtime() ) {
+		return;
+	}
+	en_msg *em = wheel.advance(par->getcurrtime());
+	while ( em ) {
+		en_msg *next = em->next;
+		emulnet.getInbox(*(int *)(em->to.addr)).push_back(em);
+		em = next;
+	}
+}
+
+/**
+ * FUNCTION NAME: appendToFrame
+ *
+ * DESCRIPTION: Add a message to the frame src is filling for dst in this tick, if
+ * 				there is one and it has room
+ *
+ * RETURNS:
+ * true if the message was appended
+ */
+bool EmulNet::appendToFrame(int src, int dst, char *data, int size) {
+	unordered_map<long long, open_frame>::iterator it = openFrames.find(linkKey(src, dst));
+	if ( it == openFrames.end() ) {
+		return false;
+	}
+	en_msg *em = it->second.frame;
+	if ( it->second.time != par->getcurrtime() || em->size + (int)sizeof(int) + size > par->MAX_MSG_SIZE ) {
+		openFrames.erase(it);
+		return false;
+	}
+	char *rec = (char *)(em + 1) + em->size;
+	memcpy(rec, &size, sizeof(int));
+	memcpy(rec + sizeof(int), data, size);
+	em->size += sizeof(int) + size;
+	em->count++;
+
+	// Every record takes its share of the bandwidth, and the frame arrives with its last byte
+	link_model *model = modelFor(it->first);
+	if ( model->bandwidth > 0 && it->second.delayed ) {
+		int deliverAt = par->getcurrtime() + it->second.latency + chargeLink(it->first, *model, sizeof(int) + size);
+		if ( deliverAt > em->deliverAt ) {
+			wheel.reschedule(em, deliverAt);
+		}
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: newSlot
+ *
+ * DESCRIPTION: Take a slot and fill it with one message, framed when coalescing is on
+ */
+en_msg *EmulNet::newSlot(Address *myaddr, Address *toaddr, char *data, int size) {
+	en_msg *em = allocSlot();
+
+	memcpy(&(em->from.addr), &(myaddr->addr), sizeof(em->from.addr));
+	memcpy(&(em->to.addr), &(toaddr->addr), sizeof(em->from.addr));
+	if ( par->COALESCE ) {
+		em->count = 1;
+		em->size = sizeof(int) + size;
+		memcpy((char *)(em + 1), &size, sizeof(int));
+		memcpy((char *)(em + 1) + sizeof(int), data, size);
+	}
+	else {
+		em->count = 0;
+		em->size = size;
+		memcpy(em + 1, data, size);
+	}
+	return em;
+}
 
 /**
  * FUNCTION NAME: ENinit
@@ -76,6 +425,55 @@ void *EmulNet::ENinit(Address *myaddr, short port) {
 	return myaddr;
 }
 
+/**
+ * FUNCTION NAME: ENhold
+ *
+ * DESCRIPTION: Start holding sends in per-node outboxes. Used while nodes run on
+ * 				several threads: each thread only sends as its own node, so the
+ * 				outboxes need no locking.
+ */
+void EmulNet::ENhold() {
+	if ( (int)outbox.size() <= par->EN_GPSZ ) {
+		outbox.resize(par->EN_GPSZ + 1);
+	}
+	// Size the tables ENrecv touches now, so they do not grow under the threads
+	counterFor(par->EN_GPSZ);
+	emulnet.getInbox(par->EN_GPSZ);
+	holding = true;
+}
+
+/**
+ * FUNCTION NAME: ENrelease
+ *
+ * DESCRIPTION: Stop holding and send what every node queued, visiting the nodes in
+ * 				the given order. The sequence of sends then does not depend on how the
+ * 				threads were scheduled, so a run is repeatable for a given THREADS value.
+ */
+void EmulNet::ENrelease(vector<int> &order) {
+	Address from, to;
+	int size;
+
+	holding = false;
+	for ( size_t i = 0; i < order.size(); i++ ) {
+		if ( order[i] < 0 || order[i] >= (int)outbox.size() ) {
+			continue;
+		}
+		vector<char> &box = outbox[order[i]];
+		size_t pos = 0;
+		while ( pos < box.size() ) {
+			memcpy(from.addr, &box[pos], sizeof(from.addr));
+			pos += sizeof(from.addr);
+			memcpy(to.addr, &box[pos], sizeof(to.addr));
+			pos += sizeof(to.addr);
+			memcpy(&size, &box[pos], sizeof(int));
+			pos += sizeof(int);
+			send(&from, &to, &box[pos], size);
+			pos += size;
+		}
+		box.clear();
+	}
+}
+
 /**
  * FUNCTION NAME: ENsend
  *
@@ -85,30 +483,75 @@ void *EmulNet::ENinit(Address *myaddr, short port) {
  * size
  */
 int EmulNet::ENsend(Address *myaddr, Address *toaddr, char *data, int size) {
+	int src = *(int *)(myaddr->addr);
+
+	if ( holding && src >= 0 && src < (int)outbox.size() ) {
+		if ( size < 0 ) {
+			return 0;
+		}
+		vector<char> &box = outbox[src];
+		box.insert(box.end(), myaddr->addr, myaddr->addr + sizeof(myaddr->addr));
+		box.insert(box.end(), toaddr->addr, toaddr->addr + sizeof(toaddr->addr));
+		box.insert(box.end(), (char *)&size, (char *)&size + sizeof(int));
+		box.insert(box.end(), data, data + size);
+		return size;
+	}
+	return send(myaddr, toaddr, data, size);
+}
+
+/**
+ * FUNCTION NAME: send
+ *
+ * DESCRIPTION: Put a message on the network: drop it, delay it or queue it for its destination
+ *
+ * RETURNS:
+ * size
+ */
+int EmulNet::send(Address *myaddr, Address *toaddr, char *data, int size) {
 	en_msg *em;
 	static char temp[2048];
-	int sendmsg = rand() % 100;
+	int src = *(int *)(myaddr->addr);
+	int dst = *(int *)(toaddr->addr);
+	int sendmsg = rngFor(src).below(100);
 
-	if( (emulnet.currbuffsize >= ENBUFFSIZE) || (size + (int)sizeof(en_msg) >= par->MAX_MSG_SIZE) || (par->dropmsg && sendmsg < (int) (par->MSG_DROP_PROB * 100)) ) {
+	if( (size < 0) || (size > ENmaxPayload()) || (par->dropmsg && sendmsg < (int) (par->MSG_DROP_PROB * 100)) ) {
 		return 0;
 	}
 
-	em = (en_msg *)malloc(sizeof(en_msg) + size);
-	em->size = size;
+	if ( dst < 0 || par->isolated(src, dst) ) {
+		return 0;
+	}
 
-	memcpy(&(em->from.addr), &(myaddr->addr), sizeof(em->from.addr));
-	memcpy(&(em->to.addr), &(toaddr->addr), sizeof(em->from.addr));
-	memcpy(em + 1, data, size);
+	if ( par->COALESCE && appendToFrame(src, dst, data, size) ) {
+		countSent(src, dst, data, size);
+		return size;
+	}
 
-	emulnet.buff[emulnet.currbuffsize++] = em;
+	if ( emulnet.currbuffsize >= ENBUFFSIZE ) {
+		return 0;
+	}
 
-	int src = *(int *)(myaddr->addr);
-	int time = par->getcurrtime();
+	em = newSlot(myaddr, toaddr, data, size);
+	int latency;
+	int delay = linkDelay(src, dst, em->size, &latency);
+	if ( par->COALESCE ) {
+		open_frame of = {em, par->getcurrtime(), latency, delay > 0};
+		openFrames[linkKey(src, dst)] = of;
+	}
 
-	assert(src <= MAX_NODES);
-	assert(time < MAX_TIME);
+	if ( delay > 0 ) {
+		em->deliverAt = par->getcurrtime() + delay;
+		wheel.schedule(em);
+	}
+	else {
+		emulnet.getInbox(dst).push_back(em);
+	}
+	emulnet.currbuffsize++;
 
-	sent_msgs[src][time]++;
+	countSent(src, dst, data, size);
+	if ( src >= 0 ) {
+		counterFor(src).countSentFrame(par->getcurrtime());
+	}
 
 	#ifdef DEBUGLOG
 		sprintf(temp, "Sending 4+%d B msg type %d to %d.%d.%d.%d:%d ", size-4, *(int *)data, toaddr->addr[0], toaddr->addr[1], toaddr->addr[2], toaddr->addr[3], *(short *)&toaddr->addr[4]);
@@ -120,58 +563,101 @@ int EmulNet::ENsend(Address *myaddr, Address *toaddr, char *data, int size) {
 /**
  * FUNCTION NAME: ENsend
  *
- * DESCRIPTION: EmulNet send function
+ * DESCRIPTION: EmulNet send function. The string is copied straight into the message slot.
  *
  * RETURNS:
  * size
  */
 int EmulNet::ENsend(Address *myaddr, Address *toaddr, string data) {
-	char * str = (char *) malloc(data.length() * sizeof(char));
-	memcpy(str, data.c_str(), data.size());
-	int ret = this->ENsend(myaddr, toaddr, str, (data.length() * sizeof(char)));
-	free(str);
-	return ret;
+	return this->ENsend(myaddr, toaddr, (char *)data.data(), (int)data.size());
 }
 
 /**
  * FUNCTION NAME: ENrecv
  *
- * DESCRIPTION: EmulNet receive function
+ * DESCRIPTION: EmulNet receive function. Only the inbox of myaddr is visited,
+ * 				so the cost is proportional to the messages addressed to this node
  *
  * RETURN:
  * 0
  */
 int EmulNet::ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct timeval *t, int times, void *queue){
 	// times is always assumed to be 1
-	int i;
+	size_t i;
 	char* tmp;
 	int sz;
 	en_msg *emsg;
 
-	for( i = emulnet.currbuffsize - 1; i >= 0; i-- ) {
-		emsg = emulnet.buff[i];
+	deliverDue();
+
+	int dst = *(int *)(myaddr->addr);
+	if ( dst < 0 || dst >= (int)emulnet.inbox.size() ) {
+		return 0;
+	}
+	vector<en_msg*> &box = emulnet.inbox[dst];
+	if ( box.empty() ) {
+		return 0;
+	}
+
+	MsgCounter &counter = counterFor(dst);
+	int time = par->getcurrtime();
 
-		if ( 0 == strcmp(emsg->to.addr, myaddr->addr) ) {
+	for( i = 0; i < box.size(); i++ ) {
+		emsg = box[i];
+
+		if ( emsg->count == 0 ) {
 			sz = emsg->size;
 			tmp = (char *) malloc(sz * sizeof(char));
 			memcpy(tmp, (char *)(emsg+1), sz);
 
-			emulnet.buff[i] = emulnet.buff[emulnet.currbuffsize-1];
-			emulnet.currbuffsize--;
-
 			(*enq)(queue, (char *)tmp, sz);
+		}
+		else {
+			// Split the frame back into its messages, in send order
+			char *rec = (char *)(emsg+1);
+			for ( int r = 0; r < emsg->count; r++ ) {
+				memcpy(&sz, rec, sizeof(int));
+				tmp = (char *) malloc(sz * sizeof(char));
+				memcpy(tmp, rec + sizeof(int), sz);
+				rec += sizeof(int) + sz;
+
+				(*enq)(queue, (char *)tmp, sz);
+			}
+		}
+	}
 
-			free(emsg);
-
-			int dst = *(int *)(myaddr->addr);
-			int time = par->getcurrtime();
-
-			assert(dst <= MAX_NODES);
-			assert(time < MAX_TIME);
+	// The pool, the buffer count and the open frames are shared with other receivers
+	unique_lock<mutex> guard(recvLock, defer_lock);
+	if ( holding ) {
+		guard.lock();
+	}
+	for( i = 0; i < box.size(); i++ ) {
+		emsg = box[i];
+		int src = *(int *)(emsg->from.addr);
+		if ( emsg->count == 0 ) {
+			countRecv(src, dst, (char *)(emsg+1), emsg->size);
+		}
+		else {
+			char *rec = (char *)(emsg+1);
+			for ( int r = 0; r < emsg->count; r++ ) {
+				memcpy(&sz, rec, sizeof(int));
+				countRecv(src, dst, rec + sizeof(int), sz);
+				rec += sizeof(int) + sz;
+			}
+		}
+		counter.countRecvFrame(time);
 
-			recv_msgs[dst][time]++;
+		if ( emsg->count > 0 ) {
+			// The slot is about to be reused, so the sender must not append to it any more
+			unordered_map<long long, open_frame>::iterator it = openFrames.find(linkKey(*(int *)(emsg->from.addr), dst));
+			if ( it != openFrames.end() && it->second.frame == emsg ) {
+				openFrames.erase(it);
+			}
 		}
+		releaseSlot(emsg);
 	}
+	emulnet.currbuffsize -= box.size();
+	box.clear();
 
 	return 0;
 }
@@ -185,36 +671,128 @@ int EmulNet::ENcleanup() {
 	emulnet.nextid=0;
 	int i, j;
 	int sent_total, recv_total;
+	int sent_frames, recv_frames;
 
-	FILE* file = fopen("msgcount.log", "w+");
+	// The first network starts the log, the others add their own section
+	FILE* file = fopen("msgcount.log", netId == 0 ? "w+" : "a");
 
-	while(emulnet.currbuffsize > 0) {
-		free(emulnet.buff[--emulnet.currbuffsize]);
+	for ( i = 0; i < (int)emulnet.inbox.size(); i++ ) {
+		for ( j = 0; j < (int)emulnet.inbox[i].size(); j++ ) {
+			releaseSlot(emulnet.inbox[i][j]);
+		}
+		emulnet.inbox[i].clear();
 	}
+	openFrames.clear();
+	for ( en_msg *em = wheel.drain(); em; ) {
+		en_msg *next = em->next;
+		releaseSlot(em);
+		em = next;
+	}
+	emulnet.currbuffsize = 0;
+	freeSlotPool();
 
+	fprintf(file, "== %s ==\n", name.c_str());
 	for ( i = 1; i <= par->EN_GPSZ; i++ ) {
 		fprintf(file, "node %3d ", i);
 		sent_total = 0;
 		recv_total = 0;
+		sent_frames = 0;
+		recv_frames = 0;
 
+		// Walk this node's buckets alongside the ticks, ticks without a bucket count as zero
+		MsgCounter &counter = counterFor(i);
+		size_t b = 0;
 		for (j = 0; j < par->getcurrtime(); j++) {
-
-			sent_total += sent_msgs[i][j];
-			recv_total += recv_msgs[i][j];
-			if (i != 67) {
-				fprintf(file, " (%4d, %4d)", sent_msgs[i][j], recv_msgs[i][j]);
-				if (j % 10 == 9) {
-					fprintf(file, "\n         ");
-				}
+			int sent = 0, recv = 0;
+			while ( b < counter.ticks.size() && counter.ticks[b].time < j ) {
+				b++;
 			}
-			else {
-				fprintf(file, "special %4d %4d %4d\n", j, sent_msgs[i][j], recv_msgs[i][j]);
+			if ( b < counter.ticks.size() && counter.ticks[b].time == j ) {
+				sent = counter.ticks[b].sent;
+				recv = counter.ticks[b].recv;
+				sent_frames += counter.ticks[b].sentFrames;
+				recv_frames += counter.ticks[b].recvFrames;
+			}
+
+			sent_total += sent;
+			recv_total += recv;
+			fprintf(file, " (%4d, %4d)", sent, recv);
+			if (j % 10 == 9) {
+				fprintf(file, "\n         ");
 			}
 		}
 		fprintf(file, "\n");
-		fprintf(file, "node %3d sent_total %6u  recv_total %6u\n\n", i, sent_total, recv_total);
+		fprintf(file, "node %3d sent_total %6u  recv_total %6u  sent_bytes %8lld  recv_bytes %8lld", i, sent_total, recv_total, counter.sentBytes, counter.recvBytes);
+		if ( par->COALESCE ) {
+			fprintf(file, "  sent_frames %6u  recv_frames %6u", sent_frames, recv_frames);
+		}
+		if ( counter.sendDropped ) {
+			fprintf(file, "  send_dropped %6lld", counter.sendDropped);
+		}
+		fprintf(file, "\n\n");
 	}
 
+	fprintf(file, "%-14s %8s %10s %8s %10s\n", "type", "sent", "sent_bytes", "recv", "recv_bytes");
+	for ( i = 0; i < (int)typeStats.size(); i++ ) {
+		traffic_stat &ts = typeStats[i];
+		if ( ts.sent || ts.recv ) {
+			fprintf(file, "%-14s %8lld %10lld %8lld %10lld\n", typeLabel(i - 1).c_str(), ts.sent, ts.sentBytes, ts.recv, ts.recvBytes);
+		}
+	}
+	fprintf(file, "\n");
+
+	// Links in (src, dst) order so runs can be diffed
+	vector<long long> links;
+	for ( unordered_map<long long, traffic_stat>::iterator it = linkStats.begin(); it != linkStats.end(); ++it ) {
+		links.push_back(it->first);
+	}
+	sort(links.begin(), links.end());
+	for ( i = 0; i < (int)links.size(); i++ ) {
+		traffic_stat &ls = linkStats[links[i]];
+		fprintf(file, "link %3d -> %3d sent %6lld (%8lld B)  recv %6lld (%8lld B)\n", (int)(links[i] >> 32), (int)(unsigned int)links[i], ls.sent, ls.sentBytes, ls.recv, ls.recvBytes);
+	}
+	fprintf(file, "\n");
+
 	fclose(file);
+	if ( par->TRAFFIC_CSV ) {
+		writeTrafficCsv();
+	}
 	return 0;
 }
+
+/**
+ * FUNCTION NAME: writeTrafficCsv
+ *
+ * DESCRIPTION: Write the node, type and link totals to msgcount.csv, one row each
+ */
+void EmulNet::writeTrafficCsv() {
+	FILE* file = fopen("msgcount.csv", netId == 0 ? "w" : "a");
+	int i;
+
+	if ( file == NULL ) {
+		return;
+	}
+	if ( netId == 0 ) {
+		fprintf(file, "net,scope,src,dst,type,sent,sent_bytes,recv,recv_bytes\n");
+	}
+	for ( i = 1; i <= par->EN_GPSZ; i++ ) {
+		MsgCounter &counter = counterFor(i);
+		long long sent = 0, recv = 0;
+		for ( size_t b = 0; b < counter.ticks.size(); b++ ) {
+			sent += counter.ticks[b].sent;
+			recv += counter.ticks[b].recv;
+		}
+		fprintf(file, "%s,node,%d,,,%lld,%lld,%lld,%lld\n", name.c_str(), i, sent, counter.sentBytes, recv, counter.recvBytes);
+	}
+	for ( i = 0; i < (int)typeStats.size(); i++ ) {
+		traffic_stat &ts = typeStats[i];
+		if ( ts.sent || ts.recv ) {
+			fprintf(file, "%s,type,,,%s,%lld,%lld,%lld,%lld\n", name.c_str(), typeLabel(i - 1).c_str(), ts.sent, ts.sentBytes, ts.recv, ts.recvBytes);
+		}
+	}
+	for ( unordered_map<long long, traffic_stat>::iterator it = linkStats.begin(); it != linkStats.end(); ++it ) {
+		traffic_stat &ls = it->second;
+		fprintf(file, "%s,link,%d,%d,,%lld,%lld,%lld,%lld\n", name.c_str(), (int)(it->first >> 32), (int)(unsigned int)it->first, ls.sent, ls.sentBytes, ls.recv, ls.recvBytes);
+	}
+	fclose(file);
+}
@@ -7,13 +7,13 @@
 #ifndef _EMULNET_H_
 #define _EMULNET_H_
 
-#define MAX_NODES 1000
-#define MAX_TIME 3600
 #define ENBUFFSIZE 30000
 
 #include "stdincludes.h"
 #include "Params.h"
 #include "Member.h"
+#include "TimingWheel.h"
+#include "Random.h"
 
 using namespace std;
 
@@ -27,27 +27,113 @@ typedef struct en_msg {
 	Address from;
 	// Destination node
 	Address to;
+	// Number of [int size][bytes] records in a coalesced frame, 0 for a plain message
+	int count;
+	// Delivery tick and wheel link, only used while the message is delayed
+	int deliverAt;
+	struct en_msg *next;
 }en_msg;
 
+/**
+ * Struct Name: tick_count
+ */
+typedef struct tick_count {
+	// Global time of this bucket
+	int time;
+	// Logical messages
+	int sent;
+	int recv;
+	// en_msg frames carrying them, fewer than messages when coalescing
+	int sentFrames;
+	int recvFrames;
+}tick_count;
+
+/**
+ * Struct Name: traffic_stat
+ *
+ * DESCRIPTION: Messages and payload bytes sent and received, for one message type or one link
+ */
+typedef struct traffic_stat {
+	long long sent;
+	long long sentBytes;
+	long long recv;
+	long long recvBytes;
+}traffic_stat;
+
+/**
+ * Classifies a payload into a protocol message type, -1 if it is not recognised
+ */
+typedef int (*msg_classifier)(const char *data, int size);
+/**
+ * Name of a message type returned by the classifier
+ */
+typedef const char *(*msg_type_name)(int type);
+
+/**
+ * Class Name: MsgCounter
+ *
+ * DESCRIPTION: Message counts of one node. A bucket only exists for the ticks
+ * 				in which the node sent or received something, in time order.
+ */
+class MsgCounter {
+public:
+	vector<tick_count> ticks;
+	long long sentBytes = 0;
+	long long recvBytes = 0;
+	// messages accepted for sending that the transport then lost, like a full socket buffer
+	long long sendDropped = 0;
+	tick_count& bucket(int time);
+	void countSent(int time, int bytes) {
+		bucket(time).sent++;
+		sentBytes += bytes;
+	}
+	void countRecv(int time, int bytes) {
+		bucket(time).recv++;
+		recvBytes += bytes;
+	}
+	void countSendDropped(int count) {
+		sendDropped += count;
+	}
+	void countSentFrame(int time) {
+		bucket(time).sentFrames++;
+	}
+	void countRecvFrame(int time) {
+		bucket(time).recvFrames++;
+	}
+};
+
+/**
+ * Struct Name: open_frame
+ *
+ * DESCRIPTION: Frame a node is still filling for one destination in the current tick
+ */
+typedef struct open_frame {
+	en_msg *frame;
+	int time;
+	// latency drawn for the frame, and whether it waits in the timing wheel
+	int latency;
+	bool delayed;
+}open_frame;
+
 /**
  * Class Name: EM
+ *
+ * DESCRIPTION: Messages in flight, kept in one inbox per destination node id
  */
 class EM {
 public:
 	int nextid;
+	// Total number of messages in flight across all inboxes
 	int currbuffsize;
 	int firsteltindex;
-	en_msg* buff[ENBUFFSIZE];
+	// inbox[id] holds the messages addressed to node id, in send order
+	vector< vector<en_msg*> > inbox;
 	EM() {}
 	EM& operator = (EM &anotherEM) {
 		this->nextid = anotherEM.getNextId();
 		this->currbuffsize = anotherEM.getCurrBuffSize();
 		this->firsteltindex = anotherEM.getFirstEltIndex();
-		int i = this->currbuffsize;
-		while (i > 0) {
-			this->buff[i] = anotherEM.buff[i];
-			i--;
-		}
+		this->inbox = anotherEM.inbox;
 		return *this;
 	}
 	int getNextId() {
@@ -68,6 +154,12 @@ public:
 	void setFirstEltIndex(int firsteltindex) {
 		this->firsteltindex = firsteltindex;
 	}
+	vector<en_msg*>& getInbox(int id) {
+		if ( id >= (int)inbox.size() ) {
+			inbox.resize(id + 1);
+		}
+		return inbox[id];
+	}
 	virtual ~EM() {}
 };
 
@@ -78,22 +170,79 @@ public:
  */
 class EmulNet
 { 	
-private:
+protected:
 	Params* par;
-	int sent_msgs[MAX_NODES + 1][MAX_TIME];
-	int recv_msgs[MAX_NODES + 1][MAX_TIME];
+	// Distinguishes the generators and the log sections of several EmulNets in one run
+	int netId;
+	// Label of this network in msgcount.log, e.g. "membership" or "kv"
+	string name;
+	msg_classifier classify;
+	msg_type_name typeName;
+	// typeStats[type + 1], slot 0 holds the messages the classifier did not recognise
+	vector<traffic_stat> typeStats;
+	// Traffic of every link that carried something, keyed by linkKey(src, dst)
+	unordered_map<long long, traffic_stat> linkStats;
+	traffic_stat& typeStat(const char *data, int size);
+	string typeLabel(int type);
+	void countSent(int src, int dst, const char *data, int size);
+	void countRecv(int src, int dst, const char *data, int size);
+	void writeTrafficCsv();
+	// rngs[id] makes the random choices for messages sent by node id
+	vector<Random> rngs;
+	Random& rngFor(int id);
+	// counters[id] holds the message counts of node id
+	vector<MsgCounter> counters;
 	int enInited;
 	EM emulnet;
+	// Recycled en_msg slots, each sized for sizeof(en_msg) + MAX_MSG_SIZE
+	vector<en_msg*> freeSlots;
+	en_msg *allocSlot();
+	void releaseSlot(en_msg *slot);
+	void freeSlotPool();
+	MsgCounter& counterFor(int id);
+	// Messages delayed by the link model, keyed by delivery tick
+	TimingWheel wheel;
+	// Per-link models that differ from par->LINK_MODEL, keyed by linkKey(src, dst)
+	unordered_map<long long, link_model> linkModels;
+	// Tick at which each bandwidth limited link finishes its current transmission
+	unordered_map<long long, double> linkBusy;
+	static long long linkKey(int src, int dst) {
+		return ((long long)src << 32) | (unsigned int)dst;
+	}
+	// While holding, ENsend appends [Address to][int size][bytes] to outbox[src]
+	// and ENrelease performs the real sends in a fixed node order
+	bool holding;
+	vector< vector<char> > outbox;
+	// Guards the slot pool and buffer count against concurrent ENrecv while holding
+	mutex recvLock;
+	int send(Address *myaddr, Address *toaddr, char *data, int size);
+	// Frames still accepting records, keyed by linkKey(src, dst)
+	unordered_map<long long, open_frame> openFrames;
+	bool appendToFrame(int src, int dst, char *data, int size);
+	en_msg *newSlot(Address *myaddr, Address *toaddr, char *data, int size);
+	int sampleLatency(link_model &model, Random &rng);
+	link_model *modelFor(long long key);
+	int chargeLink(long long key, link_model &model, int size);
+	int linkDelay(int src, int dst, int size, int *latency = NULL);
 public:
- 	EmulNet(Params *p);
+ 	EmulNet(Params *p, int netId = 0, const char *name = "net");
  	EmulNet(EmulNet &anotherEmulNet);
  	EmulNet& operator = (EmulNet &anotherEmulNet);
  	virtual ~EmulNet();
-	void *ENinit(Address *myaddr, short port);
+	virtual void *ENinit(Address *myaddr, short port);
 	int ENsend(Address *myaddr, Address *toaddr, string data);
-	int ENsend(Address *myaddr, Address *toaddr, char *data, int size);
-	int ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct timeval *t, int times, void *queue);
-	int ENcleanup();
+	virtual int ENsend(Address *myaddr, Address *toaddr, char *data, int size);
+	// Largest message ENsend accepts: it and its en_msg header stay below MAX_MSG_SIZE
+	int ENmaxPayload() {
+		return par->MAX_MSG_SIZE - (int)sizeof(en_msg) - 1;
+	}
+	virtual int ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct timeval *t, int times, void *queue);
+	virtual int ENcleanup();
+	void setLinkModel(int src, int dst, link_model &model);
+	void setClassifier(msg_classifier classify, msg_type_name typeName);
+	void deliverDue();
+	void ENhold();
+	void ENrelease(vector<int> &order);
 };
 
 #endif /* _EMULNET_H_ */
@@ -0,0 +1,246 @@
+/**********************************
+ * FILE NAME: FlatMap.cpp
+ *
+ * DESCRIPTION: Definition of FlatMap
+ **********************************/
+
+#include "FlatMap.h"
+
+/**
+ * Constructor
+ */
+FlatMap::FlatMap(): tombstones(0) {}
+
+/**
+ * FUNCTION NAME: matchByte
+ *
+ * DESCRIPTION: Bit i is set if control byte i of the group equals b
+ */
+uint32_t FlatMap::matchByte(size_t group, int8_t b) const {
+	const int8_t *c = &ctrl[group * FLATMAP_GROUP];
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *)c);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b)));
+#else
+	uint32_t bits = 0;
+	for ( int i = 0; i < FLATMAP_GROUP; i++ ) {
+		bits |= (uint32_t)(c[i] == b) << i;
+	}
+	return bits;
+#endif
+}
+
+/**
+ * FUNCTION NAME: matchFree
+ *
+ * DESCRIPTION: Bit i is set if slot i of the group is empty or deleted, the two control
+ * 				bytes with the high bit set
+ */
+uint32_t FlatMap::matchFree(size_t group) const {
+	const int8_t *c = &ctrl[group * FLATMAP_GROUP];
+#ifdef __SSE2__
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)c));
+#else
+	uint32_t bits = 0;
+	for ( int i = 0; i < FLATMAP_GROUP; i++ ) {
+		bits |= (uint32_t)(c[i] < 0) << i;
+	}
+	return bits;
+#endif
+}
+
+/**
+ * FUNCTION NAME: findSlot
+ *
+ * DESCRIPTION: Slot of key, whose hash is h. Groups are probed triangularly from the one
+ * 				the high bits of h pick, and a group with an empty slot ends the search.
+ *
+ * RETURNS:
+ * the slot, or ctrl.size() if key is absent
+ */
+size_t FlatMap::findSlot(string_view key, uint64_t h) const {
+	size_t n = groups();
+	if ( n == 0 ) {
+		return ctrl.size();
+	}
+	int8_t tag = (int8_t)(h & 0x7f);
+	size_t g = (h >> 7) & (n - 1);
+	for ( size_t step = 1; step <= n; step++ ) {
+		for ( uint32_t m = matchByte(g, tag); m != 0; m &= m - 1 ) {
+			size_t s = g * FLATMAP_GROUP + __builtin_ctz(m);
+			if ( entries[index[s]].first == key ) {
+				return s;
+			}
+		}
+		if ( matchByte(g, FLATMAP_EMPTY) != 0 ) {
+			break;
+		}
+		g = (g + step) & (n - 1);
+	}
+	return ctrl.size();
+}
+
+/**
+ * FUNCTION NAME: freeSlot
+ *
+ * DESCRIPTION: First empty or deleted slot on the probe sequence of hash h. The caller
+ * 				keeps the table below its maximum load, so there always is one.
+ */
+size_t FlatMap::freeSlot(uint64_t h) const {
+	size_t n = groups();
+	size_t g = (h >> 7) & (n - 1);
+	uint32_t m;
+	for ( size_t step = 1; (m = matchFree(g)) == 0; step++ ) {
+		g = (g + step) & (n - 1);
+	}
+	return g * FLATMAP_GROUP + __builtin_ctz(m);
+}
+
+/**
+ * FUNCTION NAME: slotOfEntry
+ *
+ * DESCRIPTION: Slot that points at entry e, found on the probe sequence of its key
+ * 				without comparing any key
+ */
+size_t FlatMap::slotOfEntry(uint32_t e) const {
+	uint64_t h = hashOf(entries[e].first);
+	int8_t tag = (int8_t)(h & 0x7f);
+	size_t n = groups();
+	size_t g = (h >> 7) & (n - 1);
+	for ( size_t step = 1; ; step++ ) {
+		for ( uint32_t m = matchByte(g, tag); m != 0; m &= m - 1 ) {
+			size_t s = g * FLATMAP_GROUP + __builtin_ctz(m);
+			if ( index[s] == e ) {
+				return s;
+			}
+		}
+		g = (g + step) & (n - 1);
+	}
+}
+
+/**
+ * FUNCTION NAME: rehash
+ *
+ * DESCRIPTION: Rebuild the slots with the given capacity, a power of two multiple of
+ * 				FLATMAP_GROUP, dropping every tombstone
+ */
+void FlatMap::rehash(size_t capacity) {
+	ctrl.assign(capacity, FLATMAP_EMPTY);
+	index.assign(capacity, 0);
+	tombstones = 0;
+	for ( uint32_t e = 0; e < entries.size(); e++ ) {
+		uint64_t h = hashOf(entries[e].first);
+		size_t s = freeSlot(h);
+		ctrl[s] = (int8_t)(h & 0x7f);
+		index[s] = e;
+	}
+}
+
+/**
+ * FUNCTION NAME: reserve
+ *
+ * DESCRIPTION: Make room for n entries without rehashing, at most 7/16 full so the
+ * 				table then takes as many inserts again before it grows
+ */
+void FlatMap::reserve(size_t n) {
+	size_t capacity = FLATMAP_GROUP;
+	while ( capacity * 7 < n * 16 ) {
+		capacity *= 2;
+	}
+	entries.reserve(n);
+	if ( capacity > ctrl.size() ) {
+		rehash(capacity);
+	}
+}
+
+/**
+ * FUNCTION NAME: find
+ *
+ * DESCRIPTION: Entry of key, NULL if it is absent
+ */
+FlatMap::value_type *FlatMap::find(string_view key) {
+	size_t s = findSlot(key, hashOf(key));
+	return s == ctrl.size() ? NULL : &entries[index[s]];
+}
+
+/**
+ * FUNCTION NAME: insert
+ *
+ * DESCRIPTION: Add (key, value) if key is absent. The key is copied and value moved only
+ * 				then, so a caller finding key present still owns value. Full and deleted
+ * 				slots are kept at or below 7/8 of the table, above that it is rebuilt,
+ * 				twice as large unless mostly tombstones filled it.
+ *
+ * RETURNS:
+ * the entry of key, and whether it was added
+ */
+pair<FlatMap::value_type *, bool> FlatMap::insert(string_view key, string &&value) {
+	uint64_t h = hashOf(key);
+	size_t s = findSlot(key, h);
+	if ( s != ctrl.size() ) {
+		return make_pair(&entries[index[s]], false);
+	}
+	if ( (entries.size() + tombstones + 1) * 8 > ctrl.size() * 7 ) {
+		size_t capacity = FLATMAP_GROUP;
+		while ( capacity * 7 < (entries.size() + 1) * 16 ) {
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+	s = freeSlot(h);
+	if ( ctrl[s] == FLATMAP_DELETED ) {
+		tombstones--;
+	}
+	ctrl[s] = (int8_t)(h & 0x7f);
+	index[s] = entries.size();
+	entries.emplace_back(string(key), std::move(value));
+	return make_pair(&entries.back(), true);
+}
+
+/**
+ * FUNCTION NAME: erase
+ *
+ * DESCRIPTION: Remove key. Its slot becomes empty if its group still has an empty slot,
+ * 				since no probe can have passed through such a group, and a tombstone
+ * 				otherwise. The last entry moves into the hole it leaves. The value of key is
+ * 				moved to oldValue unless it is NULL.
+ *
+ * RETURNS:
+ * true if key was present
+ */
+bool FlatMap::erase(string_view key, string *oldValue) {
+	size_t s = findSlot(key, hashOf(key));
+	if ( s == ctrl.size() ) {
+		return false;
+	}
+	uint32_t e = index[s];
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(entries[e].second);
+	}
+	if ( matchByte(s / FLATMAP_GROUP, FLATMAP_EMPTY) != 0 ) {
+		ctrl[s] = FLATMAP_EMPTY;
+	}
+	else {
+		ctrl[s] = FLATMAP_DELETED;
+		tombstones++;
+	}
+	uint32_t last = entries.size() - 1;
+	if ( e != last ) {
+		index[slotOfEntry(last)] = e;
+		entries[e] = std::move(entries[last]);
+	}
+	entries.pop_back();
+	return true;
+}
+
+/**
+ * FUNCTION NAME: clear
+ *
+ * DESCRIPTION: Remove every entry and release the slots
+ */
+void FlatMap::clear() {
+	ctrl.clear();
+	index.clear();
+	entries.clear();
+	tombstones = 0;
+}
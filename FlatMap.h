@@ -0,0 +1,84 @@
+/**********************************
+ * FILE NAME: FlatMap.h
+ *
+ * DESCRIPTION: Open addressing hash map from string to string, header file
+ **********************************/
+
+#ifndef FLATMAP_H_
+#define FLATMAP_H_
+
+#include "stdincludes.h"
+#include "Hash.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Control bytes compared at once, and slots per probed group
+#define FLATMAP_GROUP 16
+// Seed of the table hash, independent of the ring position of a key
+#define FLATMAP_SEED 2
+// Control byte of a slot that never held an entry since the last rehash
+#define FLATMAP_EMPTY ((int8_t)-128)
+// Control byte of a slot whose entry was erased
+#define FLATMAP_DELETED ((int8_t)-2)
+
+/**
+ * CLASS NAME: FlatMap
+ *
+ * DESCRIPTION: Hash map laid out like a Swiss table. Every slot has a control byte that
+ * 				holds 7 bits of the key's hash, or marks the slot empty or deleted, and a
+ * 				lookup compares a whole group of 16 control bytes with one SSE2 instruction
+ * 				before it touches any key. The entries themselves are kept densely in
+ * 				insertion order, with erase moving the last entry into the hole, so a slot
+ * 				costs one control byte and a 4 byte index and iteration is a linear scan.
+ * 				Inserting or erasing may move entries, which invalidates pointers to them.
+ * 				Lookups take the key as a string_view, so they never build a string.
+ */
+class FlatMap {
+public:
+	typedef pair<string, string> value_type;
+	typedef vector<value_type>::iterator iterator;
+private:
+	vector<int8_t> ctrl;
+	// Entry of each full slot
+	vector<uint32_t> index;
+	vector<value_type> entries;
+	size_t tombstones;
+	static uint64_t hashOf(string_view key) {
+		return hash64(key, FLATMAP_SEED);
+	}
+	size_t groups() const {
+		return ctrl.size() / FLATMAP_GROUP;
+	}
+	uint32_t matchByte(size_t group, int8_t b) const;
+	uint32_t matchFree(size_t group) const;
+	size_t findSlot(string_view key, uint64_t h) const;
+	size_t freeSlot(uint64_t h) const;
+	size_t slotOfEntry(uint32_t e) const;
+	void rehash(size_t capacity);
+public:
+	FlatMap();
+	value_type *find(string_view key);
+	pair<value_type *, bool> insert(string_view key, string &&value);
+	bool erase(string_view key, string *oldValue = NULL);
+	void reserve(size_t n);
+	void clear();
+	// bytes of the slots and entries, without what the strings hold on the heap
+	size_t tableBytes() const {
+		return ctrl.capacity() + index.capacity() * sizeof(uint32_t) + entries.capacity() * sizeof(value_type);
+	}
+	size_t size() const {
+		return entries.size();
+	}
+	bool empty() const {
+		return entries.empty();
+	}
+	iterator begin() {
+		return entries.begin();
+	}
+	iterator end() {
+		return entries.end();
+	}
+};
+
+#endif /* FLATMAP_H_ */
@@ -0,0 +1,109 @@
+/**********************************
+ * FILE NAME: Hash.h
+ *
+ * DESCRIPTION: 64-bit non-cryptographic hash used to place keys and members on
+ * 				the key-value ring. It follows the wyhash construction and reads its
+ * 				input byte by byte, so the result is the same on every compiler,
+ * 				platform and run.
+ **********************************/
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include "stdincludes.h"
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+#define HASH_P3 0x589965cc75374cc3ull
+
+/**
+ * FUNCTION NAME: hashMum
+ *
+ * DESCRIPTION: Full 64x64->128 bit product of a and b, low half into a and high half into b
+ */
+static inline void hashMum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+	hashMum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t hashRead8(const unsigned char *p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+		| (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static inline uint64_t hashRead4(const unsigned char *p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24;
+}
+
+/**
+ * FUNCTION NAME: hash64
+ *
+ * DESCRIPTION: Hash len bytes at data. Different seeds give independent hashes of the same bytes.
+ */
+static inline uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t a, b;
+
+	seed ^= hashMix(seed ^ HASH_P0, HASH_P1);
+	if ( len <= 16 ) {
+		if ( len >= 4 ) {
+			a = (hashRead4(p) << 32) | hashRead4(p + ((len >> 3) << 2));
+			b = (hashRead4(p + len - 4) << 32) | hashRead4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if ( len > 0 ) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t i = len;
+		if ( i > 48 ) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = hashMix(hashRead8(p) ^ HASH_P1, hashRead8(p + 8) ^ seed);
+				see1 = hashMix(hashRead8(p + 16) ^ HASH_P2, hashRead8(p + 24) ^ see1);
+				see2 = hashMix(hashRead8(p + 32) ^ HASH_P3, hashRead8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while ( i > 48 );
+			seed ^= see1 ^ see2;
+		}
+		while ( i > 16 ) {
+			seed = hashMix(hashRead8(p) ^ HASH_P1, hashRead8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hashRead8(p + i - 16);
+		b = hashRead8(p + i - 8);
+	}
+	a ^= HASH_P1;
+	b ^= seed;
+	hashMum(&a, &b);
+	return hashMix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+}
+
+static inline uint64_t hash64(string_view s, uint64_t seed = 0) {
+	return hash64(s.data(), s.size(), seed);
+}
+
+#endif /* _HASH_H_ */
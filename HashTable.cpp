@@ -10,18 +10,44 @@ HashTable::HashTable() {}
 
 HashTable::~HashTable() {}
 
+const char *HashTable::name() {
+	return "flat";
+}
+
 /**
  * FUNCTION NAME: create
  *
- * DESCRIPTION: This function inserts they (key,value) pair into the local hash table
+ * DESCRIPTION: This function inserts they (key,value) pair into the local hash table,
+ * 				unless the key is present already
  *
  * RETURNS:
- * true on SUCCESS
- * false in FAILURE
+ * the stored value on SUCCESS
+ * NULL if the key was present
  */
-bool HashTable::create(string key, string value) {
-	hashTable.emplace(key, value);
-	return true;
+const string *HashTable::create(string_view key, string value) {
+	pair<FlatMap::value_type *, bool> inserted = hashTable.insert(key, std::move(value));
+	return inserted.second ? &inserted.first->second : NULL;
+}
+
+/**
+ * FUNCTION NAME: createMany
+ *
+ * DESCRIPTION: Insert the (key,value) pairs whose key is not present yet, growing the table
+ * 				at most once for the whole batch.
+ * 				entries is left holding only the pairs that were inserted.
+ */
+void HashTable::createMany(vector<pair<string, string>> &entries) {
+	size_t kept = 0;
+	hashTable.reserve(hashTable.size() + entries.size());
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		if ( hashTable.insert(entries[i].first, string(entries[i].second)).second ) {
+			if ( kept != i ) {
+				entries[kept] = std::move(entries[i]);
+			}
+			kept++;
+		}
+	}
+	entries.resize(kept);
 }
 
 /**
@@ -30,83 +56,78 @@ bool HashTable::create(string key, string value) {
  * DESCRIPTION: This function searches for the key in the hash table
  *
  * RETURNS:
- * string value if found
+ * the stored value if found
  * else it returns a NULL
  */
-string HashTable::read(string key) {
-	map<string, string>::iterator search;
+const string *HashTable::read(string_view key) {
+	FlatMap::value_type *search = hashTable.find(key);
 
-	search = hashTable.find(key);
-	if ( search != hashTable.end() ) {
-		// Value found
-		return search->second;
-	}
-	else {
-		// Value not found
-		return "";
-	}
+	return search != NULL ? &search->second : NULL;
 }
 
 /**
  * FUNCTION NAME: update
  *
  * DESCRIPTION: This function updates the given key with the updated value passed in
- * 				if the key is found
+ * 				if the key is found. The value it replaces is moved to oldValue unless it is NULL.
  *
  * RETURNS:
- * true on SUCCESS
- * false on FAILURE
+ * the stored value on SUCCESS
+ * NULL on FAILURE
  */
-bool HashTable::update(string key, string newValue) {
-	map<string, string>::iterator update;
+const string *HashTable::update(string_view key, string newValue, string *oldValue) {
+	FlatMap::value_type *update = hashTable.find(key);
 
-	if (read(key).empty()) {
+	if ( update == NULL ) {
 		// Key not found
-		return false;
+		return NULL;
 	}
 	// Key found
-	//update = hashTable.at(key) = newValue;
-	hashTable.at(key) = newValue;
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(update->second);
+	}
+	update->second = std::move(newValue);
 	// Update successful
-	return true;
+	return &update->second;
 }
 
 /**
- * FUNCTION NAME: deleteKey
+ * FUNCTION NAME: upsert
  *
- * DESCRIPTION: This function deletes the given key and the corresponding value if the key is found
+ * DESCRIPTION: Set key to value whether or not it is present. The value it replaces is
+ * 				moved to oldValue unless it is NULL.
  *
  * RETURNS:
- * true on SUCCESS
- * false on FAILURE
+ * true if the key was present
+ * false if it was inserted
  */
-bool HashTable::deleteKey(string key) {
-	uint eraseCount = 0;
+bool HashTable::upsert(string_view key, string value, string *oldValue) {
+	// insert only takes value when it adds the key, so value is still ours otherwise
+	pair<FlatMap::value_type *, bool> inserted = hashTable.insert(key, std::move(value));
 
-	if (read(key).empty()) {
-		// Key not found
+	if ( inserted.second ) {
 		return false;
 	}
-	eraseCount = hashTable.erase(key);
-	if ( eraseCount < 1 ) {
-		// Could not erase
-		return false;
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(inserted.first->second);
 	}
-	// Delete was successful
+	inserted.first->second = std::move(value);
 	return true;
 }
 
 /**
- * FUNCTION NAME: isEmpty
+ * FUNCTION NAME: deleteKey
  *
- * DESCRIPTION: Returns if the hash table is empty
+ * DESCRIPTION: This function deletes the given key and the corresponding value if the key is found.
+ * 				The deleted value is moved to oldValue unless it is NULL.
  *
  * RETURNS:
- * true if hash table is empty
- * false otherwise
+ * true on SUCCESS
+ * false on FAILURE
  */
-bool HashTable::isEmpty() {
-	return hashTable.empty();
+bool HashTable::deleteKey(string_view key, string *oldValue) {
+	// A single probe both finds and erases the key
+	return hashTable.erase(key, oldValue);
 }
 
 /**
@@ -122,23 +143,35 @@ unsigned long HashTable::currentSize() {
 }
 
 /**
- * FUNCTION NAME: clear
+ * FUNCTION NAME: memoryUsage
  *
- * DESCRIPTION: Clear all contents from the hash table
+ * DESCRIPTION: Bytes held by the table and by the strings it stores
  */
-void HashTable::clear() {
-	hashTable.clear();
+size_t HashTable::memoryUsage() {
+	size_t bytes = hashTable.tableBytes();
+	for ( auto &elt : hashTable ) {
+		bytes += stringBytes(elt.first) + stringBytes(elt.second);
+	}
+	return bytes;
 }
 
 /**
- * FUNCTION NAME: count
+ * FUNCTION NAME: forEach
  *
- * DESCRIPTION: Returns the count of the number of values for the passed in key
+ * DESCRIPTION: Visit every pair, in no particular order
+ */
+void HashTable::forEach(const visitor &visit) {
+	for ( auto &elt : hashTable ) {
+		visit(elt.first, elt.second);
+	}
+}
+
+/**
+ * FUNCTION NAME: clear
  *
- * RETURNS:
- * unsigned long count (Should be always 1)
+ * DESCRIPTION: Clear all contents from the hash table
  */
-unsigned long HashTable::count(string key) {
-	return (unsigned long) hashTable.count(key);
+void HashTable::clear() {
+	hashTable.clear();
 }
 
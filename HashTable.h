@@ -13,26 +13,32 @@
 #include "stdincludes.h"
 #include "common.h"
 #include "Entry.h"
+#include "FlatMap.h"
+#include "StorageEngine.h"
 
 /**
  * CLASS NAME: HashTable
  *
- * DESCRIPTION: This class is a wrapper to the map provided by C++ STL.
- *
+ * DESCRIPTION: Storage engine that keeps the pairs in a FlatMap, the default. forEach
+ * 				visits the pairs in no particular order. Each call probes the table once and
+ * 				copies no stored bytes.
  */
-class HashTable {
+class HashTable : public StorageEngine {
+private:
+	FlatMap hashTable;
 public:
-	map<string, string> hashTable;
-//public:
 	HashTable();
-	bool create(string key, string value);
-	string read(string key);
-	bool update(string key, string newValue);
-	bool deleteKey(string key);
-	bool isEmpty();
+	const char *name();
+	const string *create(string_view key, string value);
+	void createMany(vector<pair<string, string>> &entries);
+	const string *read(string_view key);
+	const string *update(string_view key, string newValue, string *oldValue = NULL);
+	bool upsert(string_view key, string value, string *oldValue = NULL);
+	bool deleteKey(string_view key, string *oldValue = NULL);
+	void forEach(const visitor &visit);
 	unsigned long currentSize();
+	size_t memoryUsage();
 	void clear();
-	unsigned long count(string key);
 	virtual ~HashTable();
 };
 
@@ -6,12 +6,17 @@
 
 #include "Log.h"
 
+static FILE *fp;
+static FILE *fp2;
+static int numwrites;
+
 /**
  * Constructor
  */
 Log::Log(Params *p) {
 	par = p;
 	firstTime = false;
+	holding = false;
 }
 
 /**
@@ -20,6 +25,7 @@ Log::Log(Params *p) {
 Log::Log(const Log &anotherLog) {
 	this->par = anotherLog.par;
 	this->firstTime = anotherLog.firstTime;
+	this->holding = false;
 }
 
 /**
@@ -43,12 +49,9 @@ Log::~Log() {}
  */
 void Log::LOG(Address *addr, const char * str, ...) {
 
-	static FILE *fp;
-	static FILE *fp2;
 	va_list vararglist;
-	static char buffer[30000];
-	static int numwrites;
-	static char stdstring[30];
+	char buffer[30000];
+	char stdstring[30] = "";
 	static char stdstring2[40];
 	static char stdstring3[40]; 
 	static int dbg_opened=0;
@@ -76,6 +79,22 @@ void Log::LOG(Address *addr, const char * str, ...) {
 	vsprintf(buffer, str, vararglist);
 	va_end(vararglist);
 
+	if ( holding && firstTime ) {
+		int id = *(int *)(addr->addr);
+		if ( id >= 0 && id < (int)heldDbg.size() ) {
+			string &held = memcmp(buffer, "#STATSLOG#", 10) == 0 ? heldStats[id] : heldDbg[id];
+			char prefix[64];
+			sprintf(prefix, "\n %s[%d] ", stdstring, par->getcurrtime());
+			held += prefix;
+			held += buffer;
+			return;
+		}
+	}
+	unique_lock<mutex> guard(writeLock, defer_lock);
+	if ( holding ) {
+		guard.lock();
+	}
+
 	if (!firstTime) {
 		int magicNumber = 0;
 		string magic = MAGIC_NUMBER;
@@ -108,13 +127,51 @@ void Log::LOG(Address *addr, const char * str, ...) {
 
 }
 
+/**
+ * FUNCTION NAME: hold
+ *
+ * DESCRIPTION: Start keeping each node's lines aside, for when nodes run on several threads
+ */
+void Log::hold(int nodes) {
+	if ( (int)heldDbg.size() <= nodes ) {
+		heldDbg.resize(nodes + 1);
+		heldStats.resize(nodes + 1);
+	}
+	holding = true;
+}
+
+/**
+ * FUNCTION NAME: release
+ *
+ * DESCRIPTION: Stop holding and write the kept lines node by node in the given order,
+ * 				so the file is the same on every run with a given THREADS value
+ */
+void Log::release(vector<int> &order) {
+	holding = false;
+	for ( size_t i = 0; i < order.size(); i++ ) {
+		if ( order[i] < 0 || order[i] >= (int)heldDbg.size() ) {
+			continue;
+		}
+		if ( !heldDbg[order[i]].empty() ) {
+			fputs(heldDbg[order[i]].c_str(), fp);
+			heldDbg[order[i]].clear();
+		}
+		if ( !heldStats[order[i]].empty() ) {
+			fputs(heldStats[order[i]].c_str(), fp2);
+			heldStats[order[i]].clear();
+		}
+	}
+	fflush(fp);
+	fflush(fp2);
+}
+
 /**
  * FUNCTION NAME: logNodeAdd
  *
  * DESCRIPTION: To Log a node add
  */
 void Log::logNodeAdd(Address *thisNode, Address *addedAddr) {
-	static char stdstring[100];
+	char stdstring[100];
 	sprintf(stdstring, "Node %d.%d.%d.%d:%d joined at time %d", addedAddr->addr[0], addedAddr->addr[1], addedAddr->addr[2], addedAddr->addr[3], *(short *)&addedAddr->addr[4], par->getcurrtime());
     LOG(thisNode, stdstring);
 }
@@ -125,7 +182,7 @@ void Log::logNodeAdd(Address *thisNode, Address *addedAddr) {
  * DESCRIPTION: To log a node remove
  */
 void Log::logNodeRemove(Address *thisNode, Address *removedAddr) {
-	static char stdstring[30];
+	char stdstring[100];
 	sprintf(stdstring, "Node %d.%d.%d.%d:%d removed at time %d", removedAddr->addr[0], removedAddr->addr[1], removedAddr->addr[2], removedAddr->addr[3], *(short *)&removedAddr->addr[4], par->getcurrtime());
     LOG(thisNode, stdstring);
 }
@@ -136,14 +193,12 @@ void Log::logNodeRemove(Address *thisNode, Address *removedAddr) {
  * DESCRTION: Call this function after successfully create a key value pair
  */
 void Log::logCreateSuccess(Address * address, bool isCoordinator, int transID, string key, string value){
-	static char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
 	else
 		str = "server";
-	sprintf(stdstring, "%s: create success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
-    LOG(address, stdstring);
+	LOG(address, "%s: create success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
 }
 
 /**
@@ -152,14 +207,12 @@ void Log::logCreateSuccess(Address * address, bool isCoordinator, int transID, s
  * DESCRIPTION: Call this function after successfully reading a key
  */
 void Log::logReadSuccess(Address * address, bool isCoordinator, int transID, string key, string value){
-    static char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
 	else
 		str = "server";
-	sprintf(stdstring, "%s: read success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
-    LOG(address, stdstring);
+	LOG(address, "%s: read success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
 }
 
 /**
@@ -168,14 +221,12 @@ void Log::logReadSuccess(Address * address, bool isCoordinator, int transID, str
  * DESCRIPTION: Call this function after successfully updating a key
  */
 void Log::logUpdateSuccess(Address * address, bool isCoordinator, int transID, string key, string newValue){
-    static char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
 	else
 		str = "server";
-	sprintf(stdstring, "%s: update success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), newValue.c_str());
-    LOG(address, stdstring);
+	LOG(address, "%s: update success at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), newValue.c_str());
 }
 
 /**
@@ -184,7 +235,7 @@ void Log::logUpdateSuccess(Address * address, bool isCoordinator, int transID, s
  * DESCRIPTION: Call this function after successfully deleting a key
  */
 void Log::logDeleteSuccess(Address * address, bool isCoordinator, int transID, string key){
-    static char stdstring[100];
+    char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
@@ -200,14 +251,12 @@ void Log::logDeleteSuccess(Address * address, bool isCoordinator, int transID, s
  * DESCRIPTION: Call this function if CREATE failed
  */
 void Log::logCreateFail(Address * address, bool isCoordinator, int transID, string key, string value){
-	static char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
 	else
 		str = "server";
-	sprintf(stdstring, "%s: create fail at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
-    LOG(address, stdstring);
+	LOG(address, "%s: create fail at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), value.c_str());
 }
 
 
@@ -217,7 +266,7 @@ void Log::logCreateFail(Address * address, bool isCoordinator, int transID, stri
  * DESCRIPTION: Call this function if READ failed
  */
 void Log::logReadFail(Address * address, bool isCoordinator, int transID, string key){
-    static char stdstring[100];
+    char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
@@ -233,14 +282,12 @@ void Log::logReadFail(Address * address, bool isCoordinator, int transID, string
  * DESCRIPTION: Call this function if UPDATE failed
  */
 void Log::logUpdateFail(Address * address, bool isCoordinator, int transID, string key, string newValue){
-    static char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
 	else
 		str = "server";
-	sprintf(stdstring, "%s: update fail at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), newValue.c_str());
-    LOG(address, stdstring);
+	LOG(address, "%s: update fail at time %d, transID=%d, key=%s, value=%s", str.c_str(), par->getcurrtime(), transID, key.c_str(), newValue.c_str());
 }
 
 /**
@@ -249,7 +296,7 @@ void Log::logUpdateFail(Address * address, bool isCoordinator, int transID, stri
  * DESCRIPTION: Call this function if DELETE failed
  */
 void Log::logDeleteFail(Address * address, bool isCoordinator, int transID, string key){
-    static char stdstring[100];
+    char stdstring[100];
 	string str;
 	if (isCoordinator)
 		str = "coordinator";
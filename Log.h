@@ -29,12 +29,19 @@ class Log{
 private:
 	Params *par;
 	bool firstTime;
+	// While holding, lines are kept per node id and written by release in a fixed node order
+	bool holding;
+	vector<string> heldDbg;
+	vector<string> heldStats;
+	mutex writeLock;
 public:
 	Log(Params *p);
 	Log(const Log &anotherLog);
 	Log& operator = (const Log &anotherLog);
 	virtual ~Log();
 	void LOG(Address *, const char * str, ...);
+	void hold(int nodes);
+	void release(vector<int> &order);
 	void logNodeAdd(Address *, Address *);
 	void logNodeRemove(Address *, Address *);
 	// success
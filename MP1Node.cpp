@@ -25,6 +25,7 @@ MP1Node::MP1Node(Member *member, Params *params, EmulNet *emul, Log *log, Addres
     this->log = log;
     this->par = params;
     this->memberNode->addr = *address;
+    this->rng.seed(par->SEED, RNG_MEMBERSHIP, *(int *)(address->addr));
 }
 
 /**
@@ -508,7 +509,7 @@ void MP1Node::nodeLoopOps() {
         memberNode->memberList.begin()->heartbeat++;
         memberNode->memberList.begin()->timestamp = par->getcurrtime();
 
-        int pos = rand() % (memberNode->memberList.size() - 1) + 1;
+        int pos = rng.below(memberNode->memberList.size() - 1) + 1;
         MemberListEntry& member = memberNode->memberList[pos];
 
         if (par->getcurrtime() - member.timestamp > TFAIL) {
@@ -579,4 +580,29 @@ void MP1Node::logMemberListEntry(MemberListEntry& member)
 //#ifdef DEBUGLOG
 //    log->LOG(&memberNode->addr, "\t\tMember %i:%i: heartbeat[%li] timestamp[%li]", member.id, member.port, member.heartbeat, member.timestamp);
 //#endif
+}
+
+/**
+ * FUNCTION NAME: trafficType
+ *
+ * DESCRIPTION: Classify a membership message for the traffic accounting of EmulNet
+ */
+int MP1Node::trafficType(const char *data, int size)
+{
+    if (size < (int)sizeof(MessageHdr)) {
+        return -1;
+    }
+    int type = ((MessageHdr *)data)->msgType;
+    return (type >= 0 && type < DUMMYLASTMSGTYPE) ? type : -1;
+}
+
+/**
+ * FUNCTION NAME: trafficTypeName
+ *
+ * DESCRIPTION: Name of a type returned by trafficType
+ */
+const char *MP1Node::trafficTypeName(int type)
+{
+    static const char *names[DUMMYLASTMSGTYPE] = {"JOINREQ", "JOINREP", "HEARTBEATREQ", "HEARTBEATREP"};
+    return names[type];
 }
\ No newline at end of file
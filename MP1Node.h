@@ -14,6 +14,7 @@
 #include "Member.h"
 #include "EmulNet.h"
 #include "Queue.h"
+#include "Random.h"
 
 /**
  * Macros
@@ -57,6 +58,8 @@ private:
 	Params *par;
 	Member *memberNode;
 	char NULLADDR[6];
+	// Picks gossip targets
+	Random rng;
 
 public:
 	MP1Node(Member *, Params *, EmulNet *, Log *, Address *);
@@ -95,6 +98,9 @@ public:
 	int memcpyMemberListEntry(char * data, MemberListEntry& member);
 
 	void logMemberListEntry(MemberListEntry& member);
+
+	static int trafficType(const char *data, int size);
+	static const char *trafficTypeName(int type);
 };
 
 #endif /* _MP1NODE_H_ */
\ No newline at end of file
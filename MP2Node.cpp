@@ -4,6 +4,8 @@
  * DESCRIPTION: MP2Node class definition
  **********************************/
 #include "MP2Node.h"
+#include <sys/stat.h>
+#include <errno.h>
 
 /**
  * constructor
@@ -13,9 +15,20 @@ MP2Node::MP2Node(Member *memberNode, Params *par, EmulNet * emulNet, Log * log,
 	this->par = par;
 	this->emulNet = emulNet;
 	this->log = log;
-	ht = new HashTable();
+	ht = StorageEngine::open(par);
 	this->memberNode->addr = *address;
 	this->local_time = 0;
+	this->localTransID = 0;
+	this->lastVersionPrune = 0;
+	this->sendBuffer.resize(par->MAX_MSG_SIZE);
+	this->rng.seed(par->SEED, RNG_KVSTORE, *(int *)(address->addr));
+	memset(quorumStats, 0, sizeof(quorumStats));
+	this->warming = NULL;
+	this->lastSnapshot = 0;
+	this->snapshotRecords = 0;
+	this->snapshots = 0;
+	if(par->WAL != WAL_OFF)
+		openWal(address);
 }
 
 /**
@@ -40,7 +53,7 @@ void MP2Node::updateRing() {
 	 * Implement this. Parts of it are already implemented
 	 */
 	vector<Node> curMemList;
-	bool change = false;
+	Ring next;
 
 	/*
 	 *  Step 1. Get the current membership list from Membership Protocol / MP1
@@ -50,33 +63,92 @@ void MP2Node::updateRing() {
 	/*
 	 * Step 2: Construct the ring
 	 */
-	// Sort the list based on the hashCode
-	sort(curMemList.begin(), curMemList.end());
+	buildRing(curMemList, next);
 
 	//log->LOG(&memberNode->addr, "update finish");
 	/*
 	 * Step 3: Run the stabilization protocol IF REQUIRED
 	 */
-	// Run stabilization protocol if the hash table size is greater than zero and if there has been a changed in the ring
-	if(curMemList.size() != ring.size()){
-		ring.clear();
-		for(auto &n : curMemList)
-			ring.push_back(n);
-		stabilizationProtocol();
+	// Run stabilization protocol if there has been a change in the ring
+	bool need = next.tokens != ring.tokens;
+	for(size_t i = 0; !need && i < next.addrs.size(); i++){
+		if(!(ring.addrs[i] == next.addrs[i])){
+			need = true;
+		}
 	}
-	else{
-		bool need = false;
-		for(auto i1 = ring.begin(), i2 = curMemList.begin(); i1 != ring.end(); i1++, i2++){
-			if((*i1).nodeAddress.getAddress() != (*i2).nodeAddress.getAddress()){
-				need = true;
-				break;
-			}
+	if(need){
+		swap(ring, next);
+		findNeighbors();
+		rebuildTrees();
+		stabilizationProtocol(next);
+	}
+}
+
+/**
+ * FUNCTION NAME: buildRing
+ *
+ * DESCRIPTION: Place par->VNODES positions of every member on a ring, sorted by position.
+ * 				Equal positions are ordered by address so every node builds the same ring.
+ */
+void MP2Node::buildRing(vector<Node> &members, Ring &next) {
+	vector<Node> vnodes;
+	vnodes.reserve(members.size() * par->VNODES);
+	for(auto &n : members){
+		for(int v = 0; v < par->VNODES; v++){
+			vnodes.emplace_back(Node(n.nodeAddress, Node::tokenOf(n.nodeAddress, v)));
 		}
-		if(need){
-			ring.clear();
-			for(auto &n : curMemList)
-				ring.push_back(n);
-			stabilizationProtocol();
+	}
+	sort(vnodes.begin(), vnodes.end(), [](const Node &a, const Node &b){
+		if(a.nodeHashCode != b.nodeHashCode)
+			return a.nodeHashCode < b.nodeHashCode;
+		return memcmp(a.nodeAddress.addr, b.nodeAddress.addr, sizeof(a.nodeAddress.addr)) < 0;
+	});
+	next.tokens.resize(vnodes.size());
+	next.addrs.resize(vnodes.size());
+	for(size_t i = 0; i < vnodes.size(); i++){
+		next.tokens[i] = vnodes[i].nodeHashCode;
+		next.addrs[i] = vnodes[i].nodeAddress;
+	}
+	next.members = members.size();
+}
+
+/**
+ * FUNCTION NAME: findNeighbors
+ *
+ * DESCRIPTION: Work out which members hold replicas of the ranges this node is primary
+ * 				for, and which members' primary ranges this node holds replicas of
+ */
+void MP2Node::findNeighbors() {
+	hasMyReplicas.clear();
+	haveReplicasOf.clear();
+	size_t n = ring.tokens.size();
+	int count = par->QUORUM.n;
+	if((int)ring.members < count)
+		return;
+	auto addUnique = [](vector<Node> &list, Node node){
+		for(auto &l : list){
+			if(l.nodeAddress == node.nodeAddress)
+				return;
+		}
+		list.push_back(node);
+	};
+	for(size_t i = 0; i < n; i++){
+		if(!(ring.addrs[i] == memberNode->addr))
+			continue;
+		ReplicaSet mine = ring.replicasAt(ring.tokens[i], count);
+		for(auto &r : mine){
+			if(!(r.nodeAddress == memberNode->addr))
+				addUnique(hasMyReplicas, r);
+		}
+		// Walk back over the ranges before this position while they still reach this node
+		for(size_t back = 1; back < n; back++){
+			size_t j = (i + n - back) % n;
+			if(ring.addrs[j] == memberNode->addr)
+				break;
+			ReplicaSet theirs = ring.replicasAt(ring.tokens[j], count);
+			if(!theirs.contains(memberNode->addr))
+				break;
+			addUnique(haveReplicasOf, theirs[0]);
 		}
 	}
 }
@@ -112,12 +184,85 @@ vector<Node> MP2Node::getMembershipList() {
  * 				HASH FUNCTION USED FOR CONSISTENT HASHING
  *
  * RETURNS:
- * size_t position on the ring
+ * position on the ring
+ */
+uint64_t MP2Node::hashFunction(string_view key) {
+	return hash64(key);
+}
+
+/**
+ * FUNCTION NAME: nextTransID
+ *
+ * DESCRIPTION: transID of a bulk transfer or repair write this node starts. Those are taken
+ * 				while the nodes run in parallel, so they come from a counter of this node
+ * 				under its id rather than from g_transID. The top bit keeps them apart from
+ * 				client transIDs.
+ */
+int MP2Node::nextTransID() {
+	unsigned int id = *(unsigned int *)(memberNode->addr.addr);
+	return (int)(0x80000000u | ((id & 0x7ff) << 20) | (localTransID++ & 0xfffff));
+}
+
+/**
+ * FUNCTION NAME: frameCapacity
+ *
+ * DESCRIPTION: Bytes of value that fit in one message next to a key of keySize bytes,
+ * 				within the largest message EmulNet sends. Chunked transfers fill their
+ * 				messages up to it.
+ */
+size_t MP2Node::frameCapacity(size_t keySize) {
+	return emulNet->ENmaxPayload() - MESSAGE_HEADER_SIZE - 2 * MESSAGE_MAX_VARINT - keySize;
+}
+
+/**
+ * FUNCTION NAME: fitsInChunk
+ *
+ * DESCRIPTION: Whether a key and value fit as one entry in a chunk of every transfer that
+ * 				may carry them: BULK, hinted BULK with its version prefix, and SYNC_ENTRIES,
+ * 				whose chunks have the larger key and start with a BULK header
+ */
+bool MP2Node::fitsInChunk(string_view key, string_view value) {
+	size_t data = value.size() + HINT_META_SIZE;
+	size_t entry = varintSize(key.size()) + key.size() + varintSize(data) + data;
+	return BULK_HEADER_SIZE + entry <= frameCapacity(SYNC_HEADER_SIZE);
+}
+
+/**
+ * FUNCTION NAME: sendMessage
+ *
+ * DESCRIPTION: Single send path of the KV store. The frame is encoded straight into
+ * 				this node's send buffer and handed to EmulNet, which copies it once
+ * 				into a pooled slot.
+ *
+ * RETURNS:
+ * number of bytes sent, 0 if the network dropped the message, -1 if it is larger
+ * than the network sends
  */
-size_t MP2Node::hashFunction(string key) {
-	std::hash<string> hashFunc;
-	size_t ret = hashFunc(key);
-	return ret%RING_SIZE;
+int MP2Node::sendMessage(Address *toAddr, int transID, MessageType type, string_view key, string_view value,
+		ReplicaType replica, unsigned char flags) {
+	int size = Message::encode(sendBuffer.data(), emulNet->ENmaxPayload(), transID, memberNode->addr,
+			type, replica, flags, key, value);
+	if ( size < 0 ) {
+		log->LOG(&memberNode->addr, "Cannot send a %s of %d bytes, the limit is %d", Message::trafficTypeName(type),
+				Message::encodedSize(key, value), emulNet->ENmaxPayload());
+		return -1;
+	}
+	return emulNet->ENsend(&memberNode->addr, toAddr, sendBuffer.data(), size);
+}
+
+/**
+ * FUNCTION NAME: sendAck
+ *
+ * DESCRIPTION: Acknowledge a write. While the write-ahead log is open the message is held
+ * 				until commitWal has logged the write, otherwise it is sent right away.
+ */
+void MP2Node::sendAck(Address *toAddr, int transID, MessageType type, string_view key, string_view value,
+		ReplicaType replica, unsigned char flags) {
+	if(!wal.isOpen()){
+		sendMessage(toAddr, transID, type, key, value, replica, flags);
+		return;
+	}
+	heldReplies.push_back(held_reply{*toAddr, transID, type, string(key), string(value), replica, flags});
 }
 
 /**
@@ -129,63 +274,35 @@ size_t MP2Node::hashFunction(string key) {
  * 				2) Finds the replicas of this key
  * 				3) Sends a message to the replica
  */
-void MP2Node::clientCreate(string key, string value) {
+void MP2Node::clientCreate(string key, string value, int quorum) {
 	/*
 	 * Implement this
 	 */
 
 	//log->LOG(&memberNode->addr, "Create start %s", key.c_str());
 
-	vector<Node> memList = findNodes(key);
+	ReplicaSet memList = findNodes(key);
 	if(memList.empty()){
 		//log->LOG(&memberNode->addr, "No nodes");
+		return;
 	}
-	Node n1 = memList[0], n2 = memList[1], n3 = memList[2];
 	int cur_transID = g_transID++;
+	// A value no chunk can carry could never be streamed to a new replica
+	if(!fitsInChunk(key, value)){
+		log->LOG(&memberNode->addr, "Refuse key %s, its value of %zu bytes does not fit in a chunk", key.c_str(), value.size());
+		log->logCreateFail(&memberNode->addr, true, cur_transID, key, value);
+		return;
+	}
 
+	//now send this message to the N replicas, the ones after the third are tagged TERTIARY
+	for(int i = 0; i < memList.size(); i++){
+		sendMessage(&memList[i].nodeAddress, cur_transID, CREATE, key, value, (ReplicaType)min(i, (int)TERTIARY));
+	}
+	addHints(memList, cur_transID, key, value, false);
 
-	//log->LOG(&memberNode->addr, "Addresses are %s, %s, %s", n1.nodeAddress.getAddress().c_str(), n2.nodeAddress.getAddress().c_str(), n3.nodeAddress.getAddress().c_str());
-	//now send this message to the three processes
-	Message* cur_msg = new Message(cur_transID, memberNode->addr, CREATE, key, value, PRIMARY);
-	char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n1.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &(n1.nodeAddress), data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	cur_msg = new Message(cur_transID, memberNode->addr, CREATE, key, value, SECONDARY);
-	data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n2.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &n2.nodeAddress, data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	cur_msg = new Message(cur_transID, memberNode->addr, CREATE, key, value, TERTIARY);
-	data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n3.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &n3.nodeAddress, data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	wait_element* WE = new wait_element;
-	WE->msgType = CREATE;
-	WE->transID = cur_transID;
-	WE->key = key;
+	wait_element* WE = startRequest(CREATE, cur_transID, key, memList.size(), quorum > 0 ? quorum : par->quorumFor(key).w);
 	WE->value = value;
-	WE->count = 0;
-	WE->cur_time = local_time;
-	WE->should_drop = false;
 
-	waitingForReply.push_back(WE); 
 
 	//log->LOG(&memberNode->addr, "Create end");
 
@@ -200,37 +317,33 @@ void MP2Node::clientCreate(string key, string value) {
  * 				2) Finds the replicas of this key
  * 				3) Sends a message to the replica
  */
-void MP2Node::clientRead(string key){
+void MP2Node::clientRead(string key, int quorum){
 	/*
 	 * Implement this
 	 */
 	//log->LOG(&memberNode->addr, "Read start");
 
-	vector<Node> memList = findNodes(key);
+	ReplicaSet memList = findNodes(key);
 	if(memList.empty()) return;
 	int cur_transID = g_transID++;
-	for(int i = 0; i < 3; i++){
+	for(int i = 0; i < memList.size(); i++){
 		log->LOG(&memberNode->addr, "Choose %s for read", memList[i].nodeAddress.getAddress().c_str());
-		Message* cur_msg = new Message(cur_transID, memberNode->addr, READ, key);
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = memList[i].nodeAddress;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(memList[i].nodeAddress), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+		sendMessage(&memList[i].nodeAddress, cur_transID, READ, key, "");
 	}
 
-	wait_element* WE = new wait_element;
-	WE->msgType = READ;
-	WE->transID = cur_transID;
-	WE->key = key;
-	WE->count = 0;
-	WE->cur_time = local_time;
-	WE->should_drop = false;
+	if(par->READ_REPAIR != NO_READ_REPAIR
+			&& (par->READ_REPAIR != PROBABILISTIC_READ_REPAIR || rng.uniform() < par->READ_REPAIR_CHANCE)){
+		read_repair &repair = readRepairs[cur_transID];
+		repair.key = key;
+		repair.replicas = memList;
+		memset(repair.answer, REPLY_NONE, sizeof(repair.answer));
+		repair.decided = false;
+		repair.unacked = 0;
+		repair.deadline = local_time + WAIT_TIME + 1;
+	}
+
+	startRequest(READ, cur_transID, key, memList.size(), quorum > 0 ? quorum : par->quorumFor(key).r);
 
-	waitingForReply.push_back(WE); 
 
 	//log->LOG(&memberNode->addr, "Read end");
 
@@ -245,59 +358,30 @@ void MP2Node::clientRead(string key){
  * 				2) Finds the replicas of this key
  * 				3) Sends a message to the replica
  */
-void MP2Node::clientUpdate(string key, string value){
+void MP2Node::clientUpdate(string key, string value, int quorum){
 	/*
 	 * Implement this
 	 */
 	//log->LOG(&memberNode->addr, "Update start");
 
-	vector<Node> memList = findNodes(key);
+	ReplicaSet memList = findNodes(key);
 	if(memList.empty()) return;
-	Node n1 = memList[0], n2 = memList[1], n3 = memList[2];
 	int cur_transID = g_transID++;
-	//log->LOG(&memberNode->addr, "Addresses are %s, %s, %s", n1.nodeAddress.getAddress().c_str(), n2.nodeAddress.getAddress().c_str(), n3.nodeAddress.getAddress().c_str());
-
-	//now send this message to the three processes
-	Message* cur_msg = new Message(cur_transID, memberNode->addr, UPDATE, key, value, PRIMARY);
-	char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n1.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &(n1.nodeAddress), data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	cur_msg = new Message(cur_transID, memberNode->addr, UPDATE, key, value, SECONDARY);
-	data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n2.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &n2.nodeAddress, data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	cur_msg = new Message(cur_transID, memberNode->addr, UPDATE, key, value, TERTIARY);
-	data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-	((en_msg*)data)->size = sizeof(Message);
-	((en_msg*)data)->from = memberNode->addr;
-	((en_msg*)data)->to = n3.nodeAddress;
-	memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-	emulNet->ENsend(&memberNode->addr, &n3.nodeAddress, data, sizeof(en_msg) + sizeof(Message));
-	delete cur_msg;
-	free(data);
-
-	wait_element* WE = new wait_element;
-	WE->msgType = UPDATE;
-	WE->transID = cur_transID;
-	WE->key = key;
+	if(!fitsInChunk(key, value)){
+		log->LOG(&memberNode->addr, "Refuse key %s, its value of %zu bytes does not fit in a chunk", key.c_str(), value.size());
+		log->logUpdateFail(&memberNode->addr, true, cur_transID, key, value);
+		return;
+	}
+
+	//now send this message to the N replicas, the ones after the third are tagged TERTIARY
+	for(int i = 0; i < memList.size(); i++){
+		sendMessage(&memList[i].nodeAddress, cur_transID, UPDATE, key, value, (ReplicaType)min(i, (int)TERTIARY));
+	}
+	addHints(memList, cur_transID, key, value, false);
+
+	wait_element* WE = startRequest(UPDATE, cur_transID, key, memList.size(), quorum > 0 ? quorum : par->quorumFor(key).w);
 	WE->value = value;
-	WE->count = 0;
-	WE->cur_time = local_time;
-	WE->should_drop = false;
 
-	waitingForReply.push_back(WE); 
 
 	//log->LOG(&memberNode->addr, "Update end");
 }
@@ -311,41 +395,94 @@ void MP2Node::clientUpdate(string key, string value){
  * 				2) Finds the replicas of this key
  * 				3) Sends a message to the replica
  */
-void MP2Node::clientDelete(string key){
+void MP2Node::clientDelete(string key, int quorum){
 	/*
 	 * Implement this
 	 */
 	//log->LOG(&memberNode->addr, "Delete start %s", key.c_str());
 
-	vector<Node> memList = findNodes(key);
+	ReplicaSet memList = findNodes(key);
 	if(memList.empty()){
 		log->LOG(&memberNode->addr, "No nodes");
 		return;
 	}
 	int cur_transID = g_transID++;
-	for(int i = 0; i < 3; i++){
-		Message* cur_msg = new Message(cur_transID, memberNode->addr, DELETE, key);
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = memList[i].nodeAddress;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(memList[i].nodeAddress), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+	for(int i = 0; i < memList.size(); i++){
+		sendMessage(&memList[i].nodeAddress, cur_transID, DELETE, key, "");
 	}
+	addHints(memList, cur_transID, key, "", true);
+
+	startRequest(DELETE, cur_transID, key, memList.size(), quorum > 0 ? quorum : par->quorumFor(key).w);
+
+
+	//log->LOG(&memberNode->addr, "Delete end");
+}
 
-	wait_element* WE = new wait_element;
-	WE->msgType = DELETE;
-	WE->transID = cur_transID;
+/**
+ * FUNCTION NAME: startRequest
+ *
+ * DESCRIPTION: Wait for the replies to a client request sent to replicas nodes, of which
+ * 				needed must succeed
+ */
+wait_element *MP2Node::startRequest(MessageType type, int transID, const string &key, int replicas, int needed) {
+	wait_element* WE = pending.create(transID, local_time + WAIT_TIME + 1);
+	WE->msgType = type;
+	WE->transID = transID;
 	WE->key = key;
-	WE->count = 0;
+	WE->replicas = replicas;
+	WE->needed = min(needed, replicas);
 	WE->cur_time = local_time;
-	WE->should_drop = false;
+	return WE;
+}
 
-	waitingForReply.push_back(WE); 
+/**
+ * FUNCTION NAME: completeRequest
+ *
+ * DESCRIPTION: Log the outcome of a client request, count it for its quorum level and stop
+ * 				waiting for it. value is what a successful READ returns.
+ */
+void MP2Node::completeRequest(wait_element *WE, bool success, const string *value) {
+	switch(WE->msgType){
+		case CREATE:
+			if(success)
+				log->logCreateSuccess(&memberNode->addr, true, WE->transID, WE->key, WE->value);
+			else
+				log->logCreateFail(&memberNode->addr, true, WE->transID, WE->key, WE->value);
+			break;
+		case READ:
+			if(success)
+				log->logReadSuccess(&memberNode->addr, true, WE->transID, WE->key, *value);
+			else
+				log->logReadFail(&memberNode->addr, true, WE->transID, WE->key);
+			finishRead(WE->transID, success ? value : NULL);
+			break;
+		case UPDATE:
+			if(success)
+				log->logUpdateSuccess(&memberNode->addr, true, WE->transID, WE->key, WE->value);
+			else
+				log->logUpdateFail(&memberNode->addr, true, WE->transID, WE->key, WE->value);
+			break;
+		case DELETE:
+			if(success)
+				log->logDeleteSuccess(&memberNode->addr, true, WE->transID, WE->key);
+			else
+				log->logDeleteFail(&memberNode->addr, true, WE->transID, WE->key);
+			break;
+		default:
+			break;
+	}
 
-	//log->LOG(&memberNode->addr, "Delete end");
+	quorum_stat &stat = quorumStats[WE->msgType == READ][WE->replicas][WE->needed];
+	if(success){
+		long long latency = local_time - WE->cur_time;
+		stat.success++;
+		stat.latency += latency;
+		stat.maxLatency = max(stat.maxLatency, latency);
+	}
+	else{
+		stat.fail++;
+	}
+	pending.remove(WE);
 }
 
 /**
@@ -354,14 +491,20 @@ void MP2Node::clientDelete(string key){
  * DESCRIPTION: Server side CREATE API
  * 			   	The function does the following:
  * 			   	1) Inserts key value into the local hash table
- * 			   	2) Return true or false based on success or failure
+ * 			   	2) Return true, or false if the key was present already
  */
-bool MP2Node::createKeyValue(string key, string value, ReplicaType replica) {
+bool MP2Node::createKeyValue(string_view key, string value, ReplicaType replica) {
 	/*
 	 * Implement this
 	 */
 	// Insert key, value, replicaType into the hash table
-	return ht->create(key,value);
+	const string *stored = ht->create(key, std::move(value));
+	if(stored == NULL)
+		return false;
+	treeToggle(key, *stored);
+	if(wal.isOpen())
+		wal.append(WAL_SET, key, *stored);
+	return true;
 }
 
 /**
@@ -370,9 +513,9 @@ bool MP2Node::createKeyValue(string key, string value, ReplicaType replica) {
  * DESCRIPTION: Server side READ API
  * 			    This function does the following:
  * 			    1) Read key from local hash table
- * 			    2) Return value
+ * 			    2) Return the stored value, NULL if the key is absent
  */
-string MP2Node::readKey(string key) {
+const string *MP2Node::readKey(string_view key) {
 	/*
 	 * Implement this
 	 */
@@ -388,12 +531,35 @@ string MP2Node::readKey(string key) {
  * 				1) Update the key to the new value in the local hash table
  * 				2) Return true or false based on success or failure
  */
-bool MP2Node::updateKeyValue(string key, string value, ReplicaType replica) {
+bool MP2Node::updateKeyValue(string_view key, string value, ReplicaType replica) {
 	/*
 	 * Implement this
 	 */
 	// Update key in local hash table and return true or false
-	return ht->update(key, value);
+	string old;
+	const string *stored = ht->update(key, std::move(value), &old);
+	if(stored == NULL)
+		return false;
+	treeToggle(key, old);
+	treeToggle(key, *stored);
+	if(wal.isOpen())
+		wal.append(WAL_SET, key, *stored);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: upsertKeyValue
+ *
+ * DESCRIPTION: Set key to value whether or not it is present. Repairs, hints and replica
+ * 				writes use it, since they carry the value a replica should end up with.
+ */
+void MP2Node::upsertKeyValue(string_view key, string value) {
+	string old;
+	treeToggle(key, value);
+	if(wal.isOpen())
+		wal.append(WAL_SET, key, value);
+	if(ht->upsert(key, std::move(value), &old))
+		treeToggle(key, old);
 }
 
 /**
@@ -404,12 +570,123 @@ bool MP2Node::updateKeyValue(string key, string value, ReplicaType replica) {
  * 				1) Delete the key from the local hash table
  * 				2) Return true or false based on success or failure
  */
-bool MP2Node::deletekey(string key) {
+bool MP2Node::deletekey(string_view key) {
 	/*
 	 * Implement this
 	 */
 	// Delete the key from the local hash table
-	return ht->deleteKey(key);
+	string old;
+	if(!ht->deleteKey(key, &old))
+		return false;
+	treeToggle(key, old);
+	if(wal.isOpen())
+		wal.append(WAL_DELETE, key, "");
+	return true;
+}
+
+/**
+ * FUNCTION NAME: openWal
+ *
+ * DESCRIPTION: Open this node's write-ahead log in par->WAL_DIR and recover what an earlier
+ * 				run stored: its last snapshot is mapped, with ht warming up from it, and the
+ * 				log of the writes since that snapshot is replayed on top. The hash trees of
+ * 				the recovered keys are built when the first ring is, and stabilization then
+ * 				only sends the ranges this node is missing.
+ * 				With par->WAL_RESET the files of an earlier run are removed instead, and
+ * 				recovering them is reported on stderr, since a test run then starts from the
+ * 				keys the last one left.
+ */
+void MP2Node::openWal(Address *address) {
+	if(mkdir(par->WAL_DIR.c_str(), 0755) < 0 && errno != EEXIST)
+		perror(("mkdir " + par->WAL_DIR).c_str());
+	string path = par->WAL_DIR + "/node" + to_string(*(int *)(address->addr));
+	snapshotPath = path + ".snap";
+	if(par->WAL_RESET){
+		unlink((path + ".wal").c_str());
+		unlink(snapshotPath.c_str());
+	}
+	if(!wal.open(path + ".wal", par->WAL, par->WAL_INTERVAL))
+		return;
+	WarmingTable *table = new WarmingTable(ht);
+	if(table->open(snapshotPath)){
+		ht = warming = table;
+		log->LOG(&memberNode->addr, "Snapshot mapped, %llu keys", (unsigned long long)table->snapshotSize());
+	}
+	else{
+		table->release();
+		delete table;
+	}
+	long long replayed = wal.replay(ht, warming != NULL ? warming->snapshotSequence() : 0);
+	if(replayed > 0)
+		log->LOG(&memberNode->addr, "WAL replayed %lld records, %lu keys", replayed, ht->currentSize());
+	if(ht->currentSize() > 0)
+		fprintf(stderr, "WARNING: %s recovered %lu keys of an earlier run from %s.*, set WAL_RESET: 1 to start empty\n",
+				address->getAddress().c_str(), ht->currentSize(), path.c_str());
+	snapshotRecords = wal.records;
+}
+
+/**
+ * FUNCTION NAME: commitWal
+ *
+ * DESCRIPTION: Group commit: log every write of this tick with one write and at most one
+ * 				sync, then send the acknowledgements that waited for it. If the log could
+ * 				not be committed the writes are not durable: their REPLYs are sent as
+ * 				failures and their BULKACKs are dropped, so the chunk is resent.
+ */
+void MP2Node::commitWal() {
+	if(!wal.isOpen())
+		return;
+	warmUp();
+	bool logged = wal.commit(local_time);
+	for(auto &r : heldReplies){
+		if(!logged){
+			if(r.type != REPLY)
+				continue;
+			r.flags &= ~MSG_SUCCESS;
+		}
+		sendMessage(&r.toAddr, r.transID, r.type, r.key, r.value, r.replica, r.flags);
+	}
+	heldReplies.clear();
+	// The snapshot holds every write committed so far, so the log can start over. If it
+	// cannot, replay skips the records up to the snapshot's sequence number.
+	if(logged && par->SNAPSHOT > 0 && warming == NULL && local_time - lastSnapshot >= par->SNAPSHOT
+			&& wal.records != snapshotRecords && writeSnapshot() && !wal.truncate())
+		log->LOG(&memberNode->addr, "WAL not truncated after snapshot at record %llu",
+				(unsigned long long)wal.lastSequence());
+}
+
+/**
+ * FUNCTION NAME: writeSnapshot
+ *
+ * DESCRIPTION: Write every key of ht to this node's snapshot file
+ *
+ * RETURNS:
+ * true if the snapshot is on disk
+ */
+bool MP2Node::writeSnapshot() {
+	size_t bytes = 0;
+	lastSnapshot = local_time;
+	if(!SnapshotFile::write(snapshotPath, ht, wal.lastSequence(), &bytes))
+		return false;
+	snapshotRecords = wal.records;
+	snapshots++;
+	log->LOG(&memberNode->addr, "Snapshot written, %lu keys, %zu bytes", ht->currentSize(), bytes);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: warmUp
+ *
+ * DESCRIPTION: Move the next SNAPSHOT_WARM_BATCH snapshot pairs into memory, and switch
+ * 				ht back to the in-memory engine once the snapshot is no longer read
+ */
+void MP2Node::warmUp() {
+	if(warming == NULL || warming->warm(SNAPSHOT_WARM_BATCH))
+		return;
+	ht = warming->release();
+	delete warming;
+	warming = NULL;
+	log->LOG(&memberNode->addr, "Snapshot warmed, %lu keys in memory", ht->currentSize());
 }
 
 /**
@@ -443,7 +720,12 @@ void MP2Node::checkMessages() {
 		size = memberNode->mp2q.front().size;
 		memberNode->mp2q.pop();
 
-		Message* recvMsg = (Message*)(data + sizeof(en_msg));
+		MessageView view;
+		if(!view.decode(data, size)){
+			free(data);
+			continue;
+		}
+		MessageView* recvMsg = &view;
 		//log->LOG(&memberNode->addr, "Got message from %s of type %d", recvMsg->fromAddr.getAddress().c_str(), recvMsg->type);
 		switch(recvMsg->type){
 			case CREATE:
@@ -464,9 +746,19 @@ void MP2Node::checkMessages() {
 			case READREPLY:
 				handleReplyRead(recvMsg);
 				break;
+			case SYNC:
+				handleSync(recvMsg);
+				break;
+			case BULK:
+				handleBulk(recvMsg);
+				break;
+			case BULKACK:
+				handleBulkAck(recvMsg);
+				break;
 			default:
 				break;
 		}
+		free(data);
 
 		/*
 		 * Handle the message types here
@@ -474,6 +766,12 @@ void MP2Node::checkMessages() {
 
 	}
 	//log->LOG(&memberNode->addr, "checkMessages finish");
+	resendChunks();
+	replayHints();
+	pruneVersions();
+	expireReadRepairs();
+	antiEntropy();
+	commitWal();
 
 	/*
 	 * This function should also ensure all READ and UPDATE operation
@@ -487,30 +785,85 @@ void MP2Node::checkMessages() {
  * DESCRIPTION: Find the replicas of the given keyfunction
  * 				This function is responsible for finding the replicas of a key
  */
-vector<Node> MP2Node::findNodes(string key) {
-	size_t pos = hashFunction(key);
-	vector<Node> addr_vec;
-	if (ring.size() >= 3) {
-		// if pos <= min || pos > max, the leader is the min
-		if (pos <= ring.at(0).getHashCode() || pos > ring.at(ring.size()-1).getHashCode()) {
-			addr_vec.emplace_back(ring.at(0));
-			addr_vec.emplace_back(ring.at(1));
-			addr_vec.emplace_back(ring.at(2));
+ReplicaSet MP2Node::findNodes(const string &key) {
+	return ring.replicasAt(hashFunction(key), par->quorumFor(key).n);
+}
+
+/**
+ * FUNCTION NAME: Ring::replicasAt
+ *
+ * DESCRIPTION: The count replicas of a key hashed to pos, primary first. Empty while the
+ * 				ring has fewer members than count.
+ */
+ReplicaSet Ring::replicasAt(uint64_t pos, int count) const {
+	ReplicaSet replicas;
+	size_t n = tokens.size();
+	if ((int)members >= count) {
+		// The primary owns the first position at or after pos, wrapping past the largest one.
+		// The replicas own the next positions, skipping members that were already chosen.
+		size_t i = lowerBound(pos);
+		if (i == n) {
+			i = 0;
 		}
-		else {
-			// go through the ring until pos <= node
-			for (int i=1; i<ring.size(); i++){
-				Node addr = ring.at(i);
-				if (pos <= addr.getHashCode()) {
-					addr_vec.emplace_back(addr);
-					addr_vec.emplace_back(ring.at((i+1)%ring.size()));
-					addr_vec.emplace_back(ring.at((i+2)%ring.size()));
-					break;
-				}
+		for (size_t walked = 0; walked < n && replicas.size() < count; walked++) {
+			Address addr = addrs[i];
+			if (!replicas.contains(addr)) {
+				replicas.push_back(Node(addr, tokens[i]));
+			}
+			if (++i == n) {
+				i = 0;
 			}
 		}
 	}
-	return addr_vec;
+	return replicas;
+}
+
+/**
+ * FUNCTION NAME: keyCount
+ *
+ * DESCRIPTION: Number of keys this node stores
+ */
+unsigned long MP2Node::keyCount() {
+	return ht->currentSize();
+}
+
+/**
+ * FUNCTION NAME: storageBytes
+ *
+ * DESCRIPTION: Approximate memory the storage engine of this node uses
+ */
+size_t MP2Node::storageBytes() {
+	return ht->memoryUsage();
+}
+
+/**
+ * FUNCTION NAME: storageName
+ *
+ * DESCRIPTION: Name of the storage engine of this node
+ */
+const char *MP2Node::storageName() {
+	return ht->name();
+}
+
+/**
+ * FUNCTION NAME: Ring::lowerBound
+ *
+ * DESCRIPTION: Index of the first ring position >= pos, or the ring size if there is none.
+ * 				The loop always runs log2(n) times and the select compiles to a
+ * 				conditional move, so there are no mispredicted branches.
+ */
+size_t Ring::lowerBound(uint64_t pos) const {
+	size_t n = tokens.size();
+	if (n == 0) {
+		return 0;
+	}
+	const uint64_t *base = tokens.data();
+	while (n > 1) {
+		size_t half = n / 2;
+		base = (base[half] < pos) ? base + half : base;
+		n -= half;
+	}
+	return (base - tokens.data()) + (*base < pos);
 }
 
 /************************************
@@ -518,31 +871,9 @@ vector<Node> MP2Node::findNodes(string key) {
  * list.                            *
  ************************************/
 void MP2Node::cleanUpWait(){
-	auto i = waitingForReply.begin();
-	while(i != waitingForReply.end()){
-		wait_element* WE = *i;
-		if(local_time - WE->cur_time > WAIT_TIME){
-			switch(WE->msgType){
-				case CREATE:
-					log->logCreateFail(&memberNode->addr, true, WE->transID, WE->key, WE->value);
-					break;
-				case READ:
-					log->logReadFail(&memberNode->addr, true, WE->transID, WE->key);
-					break;
-				case UPDATE:
-					log->logUpdateFail(&memberNode->addr, true, WE->transID, WE->key, WE->value);
-					break;
-				case DELETE:
-					log->logDeleteFail(&memberNode->addr, true, WE->transID, WE->key);
-					break;
-				default:
-					i++;
-					break;
-			}
-			waitingForReply.erase(i);
-			delete(WE);
-		}
-		else i++;
+	wait_element* WE;
+	while((WE = pending.nextExpired(local_time)) != NULL){
+		completeRequest(WE, false, NULL);
 	}
 }
 
@@ -564,278 +895,128 @@ bool MP2Node::recvLoop() {
     }
 }
 
-void MP2Node::handleReply(Message* msg){
-	//log->LOG(&memberNode->addr, "Found position");
-	//log->LOG(&memberNode->addr, "HRe+");
-	int transID = msg->transID;
-	auto pos = waitingForReply.begin();
-	while(pos != waitingForReply.end()){
-		if((*pos)->transID == transID) break;
-		pos++;
-	}
-	if(pos == waitingForReply.end()){
-		//log->LOG(&memberNode->addr, "HRe-");
+void MP2Node::handleReply(MessageView* msg){
+	// The replica has the write, whether or not the request is still waiting
+	if(msg->success)
+		dropHint(msg->fromAddr, string(msg->key), msg->transID);
+	wait_element* WE = pending.find(msg->transID);
+	if(WE == NULL){
 		return;
 	}
-	if(msg->success == false){
-		if((*pos)->should_drop){
-			switch ((*pos)->msgType){
-				case CREATE:
-					log->logCreateFail(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-					break;
-				case UPDATE:
-					log->logUpdateFail(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-					break;
-				case DELETE:
-					log->logDeleteFail(&memberNode->addr, true, transID, (*pos)->key);
-					break;
-				default:
-					break;
-			}
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
-		}
-		else{
-			(*pos)->should_drop = true;
-			//If its a failed msg then dont incr count, only change drop.
-		}
-		//log->LOG(&memberNode->addr, "HRe-");
+	if(WE->msgType == READ){
+		repairAcked(WE, msg);
 		return;
 	}
-
-	if((*pos)->count <= 0){
-		(*pos)->count += 1;
-		return;
-	}
-	// Else atleast 2 nodes have now replied
-	switch ((*pos)->msgType){
-		case CREATE:
-			log->logCreateSuccess(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-			break;
-		case UPDATE:
-			log->logUpdateSuccess(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-			break;
-		case DELETE:
-			log->logDeleteSuccess(&memberNode->addr, true, transID, (*pos)->key);
-			break;
-		default:
-			break;
-	}
-
-	//Now we can remove the entry from waitingForReply
-	wait_element* tmp = *pos;
-	waitingForReply.erase(pos);
-	delete tmp;
-	//log->LOG(&memberNode->addr, "HRe-");
+	if(msg->success)
+		WE->successes++;
+	else
+		WE->failures++;
+	// W acknowledgements commit the write, more than N - W refusals mean it never can be
+	if(WE->successes >= WE->needed)
+		completeRequest(WE, true, NULL);
+	else if(WE->failures > WE->replicas - WE->needed)
+		completeRequest(WE, false, NULL);
 }
 
-void MP2Node::handleReplyRead(Message* msg){
-	//log->LOG(&memberNode->addr, "HRR+");
-	int transID = msg->transID;
-	auto pos = waitingForReply.begin();
-	while(pos != waitingForReply.end()){
-		if((*pos)->transID == transID) break;
-		pos++;
-	}
-	if(pos == waitingForReply.end()) return;
+void MP2Node::handleReplyRead(MessageView* msg){
+	noteReadReply(msg);
+	wait_element* WE = pending.find(msg->transID);
+	if(WE == NULL) return;
 	//Now we are sure that the entry exists
 
 	if(msg->success == false){
-		if((*pos)->should_drop){
-			log->logReadFail(&memberNode->addr, true, transID, (*pos)->key);
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
-		}
-		else{
-			(*pos)->should_drop = true;
-			//If its a failed msg then dont incr count, only change drop.
-		}
-		return;
-	}
-
-	if((*pos)->count == 0){
-		(*pos)->count++;
-		(*pos)->value = msg->value;
-	}
-	else if((*pos)->count == 1 && !((*pos)->should_drop)){
-		(*pos)->count++;
-		if((*pos)->value == msg->value){
-			log->logReadSuccess(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
-		}
-		else{
-			(*pos)->conflicting_value = msg->value;
-		}
+		WE->failures++;
 	}
 	else{
-		(*pos)->count++;
-		if((*pos)->value == msg->value){
-			log->logReadSuccess(&memberNode->addr, true, transID, (*pos)->key, (*pos)->value);
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
-		}
-		else if((*pos)->conflicting_value == msg->value){
-			log->logReadSuccess(&memberNode->addr, true, transID, (*pos)->key, (*pos)->conflicting_value);
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
+		WE->successes++;
+		WE->values.emplace_back(msg->value);
+		const string &value = WE->values.back();
+		if(count(WE->values.begin(), WE->values.end(), value) >= WE->needed){
+			if(!holdRead(WE, value))
+				completeRequest(WE, true, &value);
+			return;
 		}
-		else{
-			log->logReadFail(&memberNode->addr, true, transID, (*pos)->key);
-			wait_element* tmp = *pos;
-			waitingForReply.erase(pos);
-			delete tmp;
-		}
-
 	}
-	//log->LOG(&memberNode->addr, "HRR-");
-	//Already an entry exists
-	//If the key matches, accept it, else do nothing
+	// Fail once no value can reach R votes with the replies still outstanding
+	int outstanding = WE->replicas - WE->successes - WE->failures;
+	int best = 0;
+	for(auto &v : WE->values)
+		best = max(best, (int)count(WE->values.begin(), WE->values.end(), v));
+	if(best + outstanding < WE->needed)
+		completeRequest(WE, false, NULL);
 }
 
 
-void MP2Node::handleCreate(Message* msg){
+void MP2Node::handleCreate(MessageView* msg){
 	//log->LOG(&memberNode->addr, "HC+");
-	if(readKey(msg->key) != "") return; //To handle duplicates
-	if(msg->delimiter == "replica"){
-		//log->LOG(&memberNode->addr, "Backing up %s : %s", msg->key.c_str(), msg->value.c_str());
-		createKeyValue(msg->key, msg->value, msg->replica);
-		return;
-	}
-	if(createKeyValue(msg->key, msg->value, msg->replica)){
-		log->logCreateSuccess(&memberNode->addr, false, msg->transID, msg->key, msg->value);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key, msg->value, msg->replica);
-		cur_msg->success = true;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
-	}
-	else{
-		log->logCreateFail(&memberNode->addr, false, msg->transID, msg->key, msg->value);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key, msg->value, msg->replica);
-		cur_msg->success = false;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
-	}
+	// A key that is present already makes this a duplicate, which is ignored
+	if(!createKeyValue(msg->key, string(msg->value), msg->replica)) return;
+	if(msg->isReplica) return;
+	noteWrite(msg->key, msg->transID);
+	log->logCreateSuccess(&memberNode->addr, false, msg->transID, string(msg->key), string(msg->value));
+
+	sendAck(&msg->fromAddr, msg->transID, REPLY, msg->key, msg->value, msg->replica, MSG_SUCCESS);
 	//log->LOG(&memberNode->addr, "HC-");
 }
 
-void MP2Node::handleRead(Message* msg){
+void MP2Node::handleRead(MessageView* msg){
 	//log->LOG(&memberNode->addr, "HR+");
-	string value = readKey(msg->key);
-	if(value == ""){
-		log->logReadFail(&memberNode->addr, false, msg->transID, msg->key);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, READREPLY, msg->key);
-		cur_msg->success = false;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+	const string *value = readKey(msg->key);
+	if(value == NULL){
+		log->logReadFail(&memberNode->addr, false, msg->transID, string(msg->key));
+
+		sendMessage(&msg->fromAddr, msg->transID, READREPLY, msg->key, "", PRIMARY, 0);
 	}
 	else{
-		log->logReadSuccess(&memberNode->addr, false, msg->transID, msg->key, value);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, READREPLY, msg->key, value, msg->replica);
-		cur_msg->success = true;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+		log->logReadSuccess(&memberNode->addr, false, msg->transID, string(msg->key), *value);
+
+		sendMessage(&msg->fromAddr, msg->transID, READREPLY, msg->key, *value, msg->replica, MSG_SUCCESS);
 	}
 	//log->LOG(&memberNode->addr, "HR-");
 	
 }
 
-void MP2Node::handleUpdate(Message* msg){
+void MP2Node::handleUpdate(MessageView* msg){
 	//log->LOG(&memberNode->addr, "HU+");
-	if(updateKeyValue(msg->key, msg->value, msg->replica)){
-		log->logUpdateSuccess(&memberNode->addr, false, msg->transID, msg->key, msg->value);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key, msg->value, msg->replica);
-		cur_msg->success = true;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+	if(msg->isReplica){
+		// Repair write: set the value whether or not the key exists, silently unless
+		// a BLOCKING read waits for it
+		upsertKeyValue(msg->key, string(msg->value));
+		if(msg->wantsAck)
+			sendAck(&msg->fromAddr, msg->transID, REPLY, msg->key, "", PRIMARY, MSG_SUCCESS);
+		return;
+	}
+	if(updateKeyValue(msg->key, string(msg->value), msg->replica)){
+		noteWrite(msg->key, msg->transID);
+		log->logUpdateSuccess(&memberNode->addr, false, msg->transID, string(msg->key), string(msg->value));
+
+		sendAck(&msg->fromAddr, msg->transID, REPLY, msg->key, msg->value, msg->replica, MSG_SUCCESS);
 	}
 	else{
-		log->logUpdateFail(&memberNode->addr, false, msg->transID, msg->key, msg->value);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key, msg->value, msg->replica);
-		cur_msg->success = false;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+		log->logUpdateFail(&memberNode->addr, false, msg->transID, string(msg->key), string(msg->value));
+
+		sendMessage(&msg->fromAddr, msg->transID, REPLY, msg->key, msg->value, msg->replica, 0);
 	}
 	//log->LOG(&memberNode->addr, "HU-");
 	
 }
 
-void MP2Node::handleDelete(Message* msg){
+void MP2Node::handleDelete(MessageView* msg){
 	//log->LOG(&memberNode->addr, "HD+");
+	if(msg->isReplica){
+		deletekey(msg->key);
+		return;
+	}
 	if(deletekey(msg->key)){
-		log->logDeleteSuccess(&memberNode->addr, false, msg->transID, msg->key);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key);
-		cur_msg->success = true;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+		noteWrite(msg->key, msg->transID);
+		log->logDeleteSuccess(&memberNode->addr, false, msg->transID, string(msg->key));
+
+		sendAck(&msg->fromAddr, msg->transID, REPLY, msg->key, "", PRIMARY, MSG_SUCCESS);
 	}
 	else{
-		log->logDeleteFail(&memberNode->addr, false, msg->transID, msg->key);
-
-		Message* cur_msg = new Message(msg->transID, memberNode->addr, REPLY, msg->key);
-		cur_msg->success = false;
-		char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-		((en_msg*)data)->size = sizeof(Message);
-		((en_msg*)data)->from = memberNode->addr;
-		((en_msg*)data)->to = msg->fromAddr;
-		memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-		emulNet->ENsend(&memberNode->addr, &(msg->fromAddr), data, sizeof(en_msg) + sizeof(Message));
-		delete cur_msg;
-		free(data);
+		log->logDeleteFail(&memberNode->addr, false, msg->transID, string(msg->key));
+
+		sendMessage(&msg->fromAddr, msg->transID, REPLY, msg->key, "", PRIMARY, 0);
 	}
 	//log->LOG(&memberNode->addr, "HD-");
 }
@@ -857,32 +1038,883 @@ int MP2Node::enqueueWrapper(void *env, char *buff, int size) {
  * 				The function does the following:
  *				1) Ensures that there are three "CORRECT" replicas of all the keys in spite of failures and joins
  *				Note:- "CORRECT" replicas implies that every key is replicated in its two neighboring nodes in the ring
+ *
+ * 				Only the ranges whose replicas changed between oldRing and the current ring are
+ * 				sent, and only to the members that became replicas of them. Each such range is
+ * 				sent by every member that was already a replica: one of them may have failed
+ * 				before the ring dropped it, and a receiver keeps the keys it has already.
+ * 				A range that kept none of its replicas is sent by every node holding keys in it.
+ * 				The keys for each new replica are streamed to it as one BULK transfer.
  */
-void MP2Node::stabilizationProtocol() {
-	/*
-	 * Implement this
-	 */
-	//log->LOG(&memberNode->addr, "Stabilizing.");
-	for(auto &elt : ht->hashTable){
-		string key = elt.first;
-		string value = elt.second;
-		//log->LOG(&memberNode->addr, "Doing key %s : %s", key.c_str(), value.c_str());
-		vector<Node> memList = findNodes(key);
-		int cur_transID = g_transID++;
-		for(auto &n : memList){
-			//log->LOG(&memberNode->addr, "%s", n.nodeAddress.getAddress().c_str());
-			Message* cur_msg = new Message(cur_transID, memberNode->addr, CREATE, key, value);
-			cur_msg->delimiter = "replica";
-			char* data = (char*) malloc(sizeof(en_msg) + sizeof(Message));
-			((en_msg*)data)->size = sizeof(Message);
-			((en_msg*)data)->from = memberNode->addr;
-			((en_msg*)data)->to = n.nodeAddress;
-			memcpy(data + sizeof(en_msg), cur_msg, sizeof(Message));
-			emulNet->ENsend(&memberNode->addr, &(n.nodeAddress), data, sizeof(en_msg) + sizeof(Message));
-			delete cur_msg;
-			free(data);
-			//No need to make waitlist entry.
+void MP2Node::stabilizationProtocol(Ring &oldRing) {
+	if(ht->currentSize() == 0)
+		return;
+
+	// The positions of both rings cut it into elementary ranges (bounds[j-1], bounds[j]],
+	// each with one replica set before the change and one after it
+	vector<uint64_t> bounds;
+	set_union(oldRing.tokens.begin(), oldRing.tokens.end(), ring.tokens.begin(), ring.tokens.end(),
+			back_inserter(bounds));
+	bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+
+	// Each N in use has its own replica sets, and its keys only go to the members they gained
+	vector<int> counts = par->replicaCounts();
+	vector<vector<pair<int, Address>>> gained(bounds.size());
+	bool any = false;
+	for(size_t j = 0; j < bounds.size(); j++){
+		for(int count : counts){
+			ReplicaSet before = oldRing.replicasAt(bounds[j], count);
+			ReplicaSet after = ring.replicasAt(bounds[j], count);
+			bool kept = false;
+			for(auto &n : after)
+				kept |= before.contains(n.nodeAddress);
+			if(kept && !(before.contains(memberNode->addr) && after.contains(memberNode->addr)))
+				continue;
+			for(auto &n : after){
+				if(!before.contains(n.nodeAddress)){
+					gained[j].emplace_back(count, n.nodeAddress);
+					any = true;
+				}
+			}
+		}
+	}
+	if(!any)
+		return;
+
+	// Scan the hash table once, sorting each key into the transfers of the members that gained it
+	vector<bulk_transfer> outgoing;
+	ht->forEach([&](const string &key, const string &value){
+		size_t j = lower_bound(bounds.begin(), bounds.end(), hashFunction(key)) - bounds.begin();
+		if(j == bounds.size())
+			j = 0;
+		if(gained[j].empty())
+			return;
+		int count = par->quorumFor(key).n;
+		for(auto &g : gained[j]){
+			if(g.first != count)
+				continue;
+			size_t t = 0;
+			while(t < outgoing.size() && !(outgoing[t].toAddr == g.second))
+				t++;
+			if(t == outgoing.size()){
+				outgoing.emplace_back();
+				outgoing[t].toAddr = g.second;
+				outgoing[t].flags = 0;
+			}
+			outgoing[t].entries.emplace_back(key, value);
+		}
+	});
+	for(auto &transfer : outgoing)
+		startTransfer(transfer);
+}
+
+/**
+ * FUNCTION NAME: startTransfer
+ *
+ * DESCRIPTION: Take over the entries of transfer and send its first chunk
+ */
+void MP2Node::startTransfer(bulk_transfer &transfer) {
+	int id = nextTransID();
+	bulk_transfer &t = transfers[id];
+	t.toAddr = transfer.toAddr;
+	t.flags = transfer.flags;
+	t.entries.swap(transfer.entries);
+	t.next = 0;
+	t.seq = 0;
+	if(!sendChunk(id, t))
+		endTransfer(id, t, false);
+}
+
+/**
+ * FUNCTION NAME: sendChunk
+ *
+ * DESCRIPTION: Send the chunk starting at transfer.next, filled up to the largest message
+ * 				the network sends
+ *
+ * RETURNS:
+ * false if the chunk could not be sent at all, so resending it is pointless
+ */
+bool MP2Node::sendChunk(int id, bulk_transfer &transfer) {
+	char header[BULK_HEADER_SIZE];
+	string payload;
+	size_t capacity = frameCapacity(BULK_HEADER_SIZE);
+
+	transfer.end = transfer.next;
+	while(transfer.end < transfer.entries.size()
+			&& appendEntry(payload, transfer.entries[transfer.end].first, transfer.entries[transfer.end].second, capacity))
+		transfer.end++;
+	// Client writes refuse such values, but one stored before cannot be streamed: skip it
+	if(transfer.end == transfer.next && transfer.end < transfer.entries.size()){
+		log->LOG(&memberNode->addr, "Bulk transfer %d skips key %s, its %zu bytes do not fit in a chunk", id,
+				transfer.entries[transfer.end].first.c_str(), transfer.entries[transfer.end].second.size());
+		transfer.end++;
+	}
+	encodeBulkHeader(header, transfer.seq, transfer.flags | (transfer.end == transfer.entries.size() ? BULK_LAST : 0));
+	if(sendMessage(&transfer.toAddr, id, BULK, string_view(header, BULK_HEADER_SIZE), payload) < 0)
+		return false;
+	transfer.deadline = local_time + WAIT_TIME;
+	transfer.retries = 0;
+	return true;
+}
+
+/**
+ * FUNCTION NAME: endTransfer
+ *
+ * DESCRIPTION: Log how a transfer ended. The caller removes it from transfers.
+ */
+void MP2Node::endTransfer(int id, bulk_transfer &transfer, bool done) {
+	const char *kind = transfer.flags & BULK_HINTED ? "Hint" : "Bulk";
+	if(done)
+		log->LOG(&memberNode->addr, "%s transfer %d to %s done: %zu keys in %u chunks", kind, id,
+				transfer.toAddr.getAddress().c_str(), transfer.entries.size(), transfer.seq + 1);
+	else
+		log->LOG(&memberNode->addr, "%s transfer %d to %s abandoned at chunk %u", kind, id,
+				transfer.toAddr.getAddress().c_str(), transfer.seq);
+}
+
+/**
+ * FUNCTION NAME: handleBulk
+ *
+ * DESCRIPTION: Store the keys of a chunk with one batched insert and acknowledge it.
+ * 				Keys that are present already are kept, so a resent chunk is harmless.
+ * 				The hints of a BULK_HINTED chunk are applied one by one instead.
+ */
+void MP2Node::handleBulk(MessageView* msg){
+	unsigned int seq;
+	unsigned char flags;
+	if(!decodeBulkHeader(msg->key, &seq, &flags))
+		return;
+	vector<pair<string, string>> entries;
+	string_view payload = msg->value, key, value;
+	while(nextEntry(&payload, &key, &value)){
+		if(flags & BULK_HINTED)
+			applyHint(key, value);
+		else
+			entries.emplace_back(string(key), string(value));
+	}
+	ht->createMany(entries);
+	for(auto &elt : entries){
+		treeToggle(elt.first, elt.second);
+		if(wal.isOpen())
+			wal.append(WAL_SET, elt.first, elt.second);
+	}
+	sendAck(&msg->fromAddr, msg->transID, BULKACK, msg->key, "");
+}
+
+/**
+ * FUNCTION NAME: handleBulkAck
+ *
+ * DESCRIPTION: Move a transfer on to its next chunk, or finish it after the last one
+ */
+void MP2Node::handleBulkAck(MessageView* msg){
+	unsigned int seq;
+	unsigned char flags;
+	auto it = transfers.find(msg->transID);
+	if(it == transfers.end() || !decodeBulkHeader(msg->key, &seq, &flags) || seq != it->second.seq)
+		return;
+	bulk_transfer &transfer = it->second;
+	if(transfer.end == transfer.entries.size()){
+		endTransfer(it->first, transfer, true);
+		transfers.erase(it);
+		return;
+	}
+	transfer.next = transfer.end;
+	transfer.seq++;
+	if(!sendChunk(it->first, transfer)){
+		endTransfer(it->first, transfer, false);
+		transfers.erase(it);
+	}
+}
+
+/**
+ * FUNCTION NAME: resendChunks
+ *
+ * DESCRIPTION: Resend chunks whose ack is overdue. A transfer whose chunk went unacknowledged
+ * 				BULK_RETRIES times in a row is dropped, its receiver has most likely failed.
+ */
+void MP2Node::resendChunks() {
+	for(auto it = transfers.begin(); it != transfers.end(); ){
+		bulk_transfer &transfer = it->second;
+		if(transfer.deadline >= local_time){
+			++it;
+			continue;
+		}
+		int retries = transfer.retries + 1;
+		if(retries > BULK_RETRIES || !sendChunk(it->first, transfer)){
+			endTransfer(it->first, transfer, false);
+			it = transfers.erase(it);
+			continue;
+		}
+		transfer.retries = retries;
+		++it;
+	}
+}
+
+/**
+ * FUNCTION NAME: noteReadReply
+ *
+ * DESCRIPTION: Record what a replica answered to a read that read repair checks. A late
+ * 				answer to a read that already has its value completes the repair.
+ */
+void MP2Node::noteReadReply(MessageView* msg) {
+	auto it = readRepairs.find(msg->transID);
+	if(it == readRepairs.end())
+		return;
+	read_repair &repair = it->second;
+	int answered = 0;
+	for(int i = 0; i < repair.replicas.size(); i++){
+		if(repair.replicas[i].nodeAddress == msg->fromAddr && repair.answer[i] == REPLY_NONE){
+			repair.answer[i] = msg->success ? REPLY_VALUE : REPLY_MISSING;
+			repair.values[i] = string(msg->value);
+		}
+		answered += repair.answer[i] != REPLY_NONE;
+	}
+	if(repair.decided && answered == repair.replicas.size()){
+		repairRead(repair);
+		readRepairs.erase(it);
+	}
+}
+
+/**
+ * FUNCTION NAME: holdRead
+ *
+ * DESCRIPTION: With BLOCKING read repair, repair the replicas that answered a read with
+ * 				something other than winner before the read returns. The repairs reuse the
+ * 				read's transID and ask for a REPLY, and the read gets another WAIT_TIME for
+ * 				them. Replicas that have not answered yet are left to finishRead.
+ *
+ * RETURNS:
+ * true if the read waits for repairs, false if it can complete now
+ */
+bool MP2Node::holdRead(wait_element *WE, const string &winner) {
+	if(par->READ_REPAIR != BLOCKING_READ_REPAIR)
+		return false;
+	auto it = readRepairs.find(WE->transID);
+	if(it == readRepairs.end())
+		return false;
+	read_repair &repair = it->second;
+	if(repair.unacked > 0)
+		return true;
+	repair.winner = winner;
+	for(int i = 0; i < repair.replicas.size(); i++){
+		if(repair.answer[i] == REPLY_NONE || (repair.answer[i] == REPLY_VALUE && repair.values[i] == winner))
+			continue;
+		log->LOG(&memberNode->addr, "Read repair of key %s writes the value read to %s", repair.key.c_str(),
+				repair.replicas[i].nodeAddress.getAddress().c_str());
+		if(repair.replicas[i].nodeAddress == memberNode->addr){
+			upsertKeyValue(repair.key, winner);
+			repair.answer[i] = REPLY_VALUE;
+			repair.values[i] = winner;
+			continue;
+		}
+		sendMessage(&repair.replicas[i].nodeAddress, WE->transID, UPDATE, repair.key, winner, PRIMARY, MSG_REPLICA | MSG_ACK);
+		repair.answer[i] = REPLY_REPAIRED;
+		repair.unacked++;
+	}
+	if(repair.unacked == 0)
+		return false;
+	pending.extend(WE, local_time + WAIT_TIME + 1);
+	repair.deadline = max(repair.deadline, local_time + WAIT_TIME + 1);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: repairAcked
+ *
+ * DESCRIPTION: A replica acknowledged the repair of a BLOCKING read. The read returns
+ * 				once every repair it sent is acknowledged, or fails when it times out.
+ */
+void MP2Node::repairAcked(wait_element *WE, MessageView* msg) {
+	auto it = readRepairs.find(WE->transID);
+	if(it == readRepairs.end() || !msg->success)
+		return;
+	read_repair &repair = it->second;
+	for(int i = 0; i < repair.replicas.size(); i++){
+		if(repair.replicas[i].nodeAddress == msg->fromAddr && repair.answer[i] == REPLY_REPAIRED){
+			repair.answer[i] = REPLY_VALUE;
+			repair.values[i] = repair.winner;
+			if(--repair.unacked == 0)
+				completeRequest(WE, true, &repair.winner);
+			return;
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: finishRead
+ *
+ * DESCRIPTION: The read has returned winner, or failed if it is NULL. Repair waits until
+ * 				every replica has answered or the read times out, so only the replicas that
+ * 				answered and really are stale get a write. BLOCKING reads repaired the ones
+ * 				that had answered before returning.
+ */
+void MP2Node::finishRead(int transID, const string *winner) {
+	auto it = readRepairs.find(transID);
+	if(it == readRepairs.end())
+		return;
+	read_repair &repair = it->second;
+	if(winner == NULL){
+		readRepairs.erase(it);
+		return;
+	}
+	repair.decided = true;
+	repair.winner = *winner;
+	int answered = 0;
+	for(int i = 0; i < repair.replicas.size(); i++)
+		answered += repair.answer[i] != REPLY_NONE;
+	if(answered == repair.replicas.size()){
+		repairRead(repair);
+		readRepairs.erase(it);
+	}
+}
+
+/**
+ * FUNCTION NAME: repairRead
+ *
+ * DESCRIPTION: Write the value a read returned to the replicas that answered anything else.
+ * 				Replicas that never answered, or were repaired already, are left alone.
+ */
+void MP2Node::repairRead(read_repair &repair) {
+	for(int i = 0; i < repair.replicas.size(); i++){
+		if(repair.answer[i] == REPLY_NONE || repair.answer[i] == REPLY_REPAIRED
+				|| (repair.answer[i] == REPLY_VALUE && repair.values[i] == repair.winner))
+			continue;
+		log->LOG(&memberNode->addr, "Read repair of key %s writes the value read to %s", repair.key.c_str(),
+				repair.replicas[i].nodeAddress.getAddress().c_str());
+		if(repair.replicas[i].nodeAddress == memberNode->addr){
+			upsertKeyValue(repair.key, repair.winner);
+		}
+		else{
+			sendMessage(&repair.replicas[i].nodeAddress, nextTransID(), UPDATE, repair.key, repair.winner, PRIMARY, MSG_REPLICA);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: expireReadRepairs
+ *
+ * DESCRIPTION: Repair the stale replicas of reads some replica did not answer in time
+ */
+void MP2Node::expireReadRepairs() {
+	for(auto it = readRepairs.begin(); it != readRepairs.end(); ){
+		if(it->second.deadline >= local_time){
+			++it;
+			continue;
+		}
+		if(it->second.decided)
+			repairRead(it->second);
+		it = readRepairs.erase(it);
+	}
+}
+
+/**
+ * FUNCTION NAME: findMember
+ *
+ * DESCRIPTION: Entry of addr in the membership list, NULL if it is not a member
+ */
+MemberListEntry *MP2Node::findMember(Address &addr) {
+	int id;
+	short port;
+	memcpy(&id, &addr.addr[0], sizeof(int));
+	memcpy(&port, &addr.addr[4], sizeof(short));
+	for(auto &m : memberNode->memberList){
+		if(m.id == id && m.port == port)
+			return &m;
+	}
+	return NULL;
+}
+
+/**
+ * FUNCTION NAME: isSuspected
+ *
+ * DESCRIPTION: Whether the membership protocol has not heard from a member for TFAIL,
+ * 				but has not removed it yet
+ */
+bool MP2Node::isSuspected(Address &addr) {
+	MemberListEntry *m = findMember(addr);
+	return m != NULL && par->getcurrtime() - m->timestamp > TFAIL;
+}
+
+/**
+ * FUNCTION NAME: addHints
+ *
+ * DESCRIPTION: Keep a hint of a client write for every replica of the key that is suspected
+ * 				of failure. The write is still sent to it, in case it is only slow.
+ */
+void MP2Node::addHints(ReplicaSet &replicas, int transID, const string &key, const string &value, bool deleted) {
+	for(auto &r : replicas){
+		if(!isSuspected(r.nodeAddress))
+			continue;
+		hint &h = hints[string(r.nodeAddress.addr, sizeof(r.nodeAddress.addr))][key];
+		h.version = writeVersion(transID);
+		h.deleted = deleted;
+		h.value = value;
+	}
+}
+
+/**
+ * FUNCTION NAME: replayHints
+ *
+ * DESCRIPTION: Send the hints of every replica the membership list shows alive again, as
+ * 				one BULK_HINTED transfer. Hints of a replica that was removed from the group
+ * 				are dropped, stabilization hands its ranges to other members.
+ */
+void MP2Node::replayHints() {
+	for(auto it = hints.begin(); it != hints.end(); ){
+		Address target;
+		memcpy(target.addr, it->first.data(), sizeof(target.addr));
+		MemberListEntry *m = findMember(target);
+		if(m != NULL && par->getcurrtime() - m->timestamp > TFAIL){
+			++it;
+			continue;
+		}
+		if(m != NULL){
+			bulk_transfer transfer;
+			transfer.toAddr = target;
+			transfer.flags = BULK_HINTED;
+			for(auto &h : it->second)
+				transfer.entries.emplace_back(h.first, encodeHintValue(h.second.version, h.second.deleted, h.second.value));
+			startTransfer(transfer);
+		}
+		it = hints.erase(it);
+	}
+}
+
+/**
+ * FUNCTION NAME: dropHint
+ *
+ * DESCRIPTION: Forget the hint of a write for target once target acknowledged that write.
+ * 				A hint of a later write to the key is kept.
+ */
+void MP2Node::dropHint(Address &target, const string &key, int transID) {
+	auto it = hints.find(string(target.addr, sizeof(target.addr)));
+	if(it == hints.end())
+		return;
+	auto h = it->second.find(key);
+	if(h == it->second.end() || (unsigned int)h->second.version != (unsigned int)transID)
+		return;
+	it->second.erase(h);
+	if(it->second.empty())
+		hints.erase(it);
+}
+
+/**
+ * FUNCTION NAME: writeVersion
+ *
+ * DESCRIPTION: Version of the client write with the given transID, ordered by the time it
+ * 				is seen and then by transID
+ */
+unsigned long long MP2Node::writeVersion(int transID) {
+	return ((unsigned long long)par->getcurrtime() << 32) | (unsigned int)transID;
+}
+
+/**
+ * FUNCTION NAME: noteWrite
+ *
+ * DESCRIPTION: Remember the version of a client write this replica applied. It is stamped
+ * 				on arrival, never before the coordinator stamped a hint of the same write,
+ * 				so that hint is not replayed over it.
+ */
+void MP2Node::noteWrite(string_view key, int transID) {
+	unsigned long long &version = writeVersions[string(key)];
+	version = max(version, writeVersion(transID));
+}
+
+/**
+ * FUNCTION NAME: pruneVersions
+ *
+ * DESCRIPTION: Every VERSION_HORIZON ticks, forget the write versions older than that.
+ * 				applyHint ignores hints that old, so there is nothing left to order them against.
+ */
+void MP2Node::pruneVersions() {
+	long long now = par->getcurrtime();
+	if(now - lastVersionPrune < VERSION_HORIZON)
+		return;
+	lastVersionPrune = now;
+	for(auto it = writeVersions.begin(); it != writeVersions.end(); ){
+		if((long long)(it->second >> 32) + VERSION_HORIZON < now)
+			it = writeVersions.erase(it);
+		else
+			++it;
+	}
+}
+
+/**
+ * FUNCTION NAME: applyHint
+ *
+ * DESCRIPTION: Apply a replayed write unless the key has a newer client write or hint.
+ * 				A hint older than VERSION_HORIZON is dropped, the version it should be
+ * 				compared with may have been pruned. Like other replica writes it is not reported
+ * 				in dbg.log, but upsertKeyValue and deletekey append it to the write-ahead log.
+ */
+void MP2Node::applyHint(string_view key, string_view data) {
+	unsigned long long version;
+	bool deleted;
+	string_view value;
+	if(!decodeHintValue(data, &version, &deleted, &value))
+		return;
+	if((long long)(version >> 32) + VERSION_HORIZON < par->getcurrtime())
+		return;
+	unsigned long long &applied = writeVersions[string(key)];
+	if(version <= applied)
+		return;
+	applied = version;
+	if(deleted)
+		deletekey(key);
+	else
+		upsertKeyValue(key, string(value));
+}
+
+/**
+ * FUNCTION NAME: rangeOf
+ *
+ * DESCRIPTION: Position ending the ring range a key falls in, and the leaf of the key in
+ * 				the hash tree of that range
+ */
+uint64_t MP2Node::rangeOf(string_view key, int *leaf) {
+	size_t n = ring.tokens.size();
+	*leaf = 0;
+	if(n == 0)
+		return 0;
+	uint64_t token = hashFunction(key);
+	size_t i = ring.lowerBound(token);
+	if(i == n)
+		i = 0;
+	*leaf = MerkleTree::leafOf(token, ring.tokens[(i + n - 1) % n], ring.tokens[i]);
+	return ring.tokens[i];
+}
+
+/**
+ * FUNCTION NAME: rangeStart
+ *
+ * DESCRIPTION: Position before the ring range ending at range, so the range is (start, range]
+ */
+uint64_t MP2Node::rangeStart(uint64_t range) {
+	size_t n = ring.tokens.size();
+	if(n == 0)
+		return range;
+	return ring.tokens[(ring.lowerBound(range) + n - 1) % n];
+}
+
+/**
+ * FUNCTION NAME: treeToggle
+ *
+ * DESCRIPTION: Add an entry to, or remove it from, the hash tree of its range
+ */
+void MP2Node::treeToggle(string_view key, string_view value) {
+	if(par->ANTI_ENTROPY <= 0)
+		return;
+	int leaf;
+	uint64_t range = rangeOf(key, &leaf);
+	trees[par->quorumFor(key).n][range].toggle(leaf, key, value);
+}
+
+/**
+ * FUNCTION NAME: rebuildTrees
+ *
+ * DESCRIPTION: Recompute the hash trees after the ranges moved with the ring
+ */
+void MP2Node::rebuildTrees() {
+	if(par->ANTI_ENTROPY <= 0)
+		return;
+	for(auto &t : trees)
+		t.clear();
+	ht->forEach([&](const string &key, const string &value){
+		int leaf;
+		uint64_t range = rangeOf(key, &leaf);
+		trees[par->quorumFor(key).n][range].toggle(leaf, key, value);
+	});
+}
+
+/**
+ * FUNCTION NAME: antiEntropy
+ *
+ * DESCRIPTION: Every par->ANTI_ENTROPY ticks, send the root of each range this node is
+ * 				primary for to the other replicas of the range. A replica whose root differs
+ * 				starts the descent described in Merkle.h, so only differing subtrees are sent.
+ */
+void MP2Node::antiEntropy() {
+	if(par->ANTI_ENTROPY <= 0)
+		return;
+	// Give up on leaves some replica never answered for
+	for(auto it = repairs.begin(); it != repairs.end(); ){
+		if(it->second.deadline < local_time)
+			it = repairs.erase(it);
+		else
+			++it;
+	}
+	if(local_time % par->ANTI_ENTROPY != 0)
+		return;
+	for(int count : par->replicaCounts()){
+		for(size_t i = 0; i < ring.tokens.size(); i++){
+			if(!(ring.addrs[i] == memberNode->addr))
+				continue;
+			uint64_t range = ring.tokens[i];
+			auto tree = trees[count].find(range);
+			string payload;
+			appendHash(payload, tree == trees[count].end() ? 0 : tree->second.root);
+			ReplicaSet replicas = ring.replicasAt(range, count);
+			for(auto &r : replicas){
+				if(!(r.nodeAddress == memberNode->addr))
+					sendSync(&r.nodeAddress, SYNC_ROOT, range, count, 0, payload);
+			}
 		}
-		
+	}
+}
+
+/**
+ * FUNCTION NAME: handleSync
+ *
+ * DESCRIPTION: Take one step of an anti-entropy exchange
+ */
+void MP2Node::handleSync(MessageView* msg){
+	static const MerkleTree emptyTree;
+	sync_header header;
+	if(!decodeSyncHeader(msg->key, &header) || header.replicas < 1 || header.replicas > MAX_REPLICAS)
+		return;
+	auto found = trees[header.replicas].find(header.range);
+	const MerkleTree &tree = found == trees[header.replicas].end() ? emptyTree : found->second;
+	string payload;
+
+	switch(header.stage){
+		case SYNC_ROOT:
+			if(msg->value.size() != 8 || tree.root == readHash(msg->value, 0))
+				return;
+			for(int m = 0; m < MERKLE_FANOUT; m++)
+				appendHash(payload, tree.mids[m]);
+			sendSync(&msg->fromAddr, SYNC_MIDS, header.range, header.replicas, 0, payload);
+			break;
+		case SYNC_MIDS:
+			if(msg->value.size() != 8 * MERKLE_FANOUT)
+				return;
+			for(int m = 0; m < MERKLE_FANOUT; m++){
+				if(tree.mids[m] == readHash(msg->value, m))
+					continue;
+				payload.clear();
+				for(int l = 0; l < MERKLE_FANOUT; l++)
+					appendHash(payload, tree.leaves[m * MERKLE_FANOUT + l]);
+				sendSync(&msg->fromAddr, SYNC_LEAVES, header.range, header.replicas, m, payload);
+			}
+			break;
+		case SYNC_LEAVES: {
+			if(msg->value.size() != 8 * MERKLE_FANOUT || header.index >= MERKLE_FANOUT)
+				return;
+			// One walk over the tokens of the interior node gathers every differing leaf
+			int first = header.index * MERKLE_FANOUT;
+			vector<map<string, string>> entries = leafEntries(header.range, header.replicas, first, first + MERKLE_FANOUT - 1);
+			for(int l = 0; l < MERKLE_FANOUT; l++){
+				if(tree.leaves[first + l] != readHash(msg->value, l))
+					sendEntries(&msg->fromAddr, header.range, header.replicas, first + l, entries[l]);
+			}
+			break;
+		}
+		case SYNC_FETCH:
+			sendEntries(&msg->fromAddr, header.range, header.replicas, header.index,
+					leafEntries(header.range, header.replicas, header.index, header.index)[0]);
+			break;
+		case SYNC_ENTRIES:
+			collectEntries(msg, header);
+			break;
+	}
+}
+
+/**
+ * FUNCTION NAME: sendSync
+ *
+ * DESCRIPTION: Send one SYNC message
+ */
+void MP2Node::sendSync(Address *toAddr, int stage, uint64_t range, int replicas, int index, string_view payload) {
+	char key[SYNC_HEADER_SIZE];
+	sync_header header = {stage, replicas, range, index};
+	encodeSyncHeader(key, header);
+	sendMessage(toAddr, 0, SYNC, string_view(key, SYNC_HEADER_SIZE), payload);
+}
+
+/**
+ * FUNCTION NAME: sendEntries
+ *
+ * DESCRIPTION: Send this node's entries in one leaf as SYNC_ENTRIES, in as many chunks as
+ * 				they need. Each chunk starts with a BULK header numbering it, and the last
+ * 				one has BULK_LAST. Chunks are not acknowledged: a lost one leaves the repair
+ * 				of the leaf incomplete until its deadline, and the next round retries it.
+ */
+void MP2Node::sendEntries(Address *toAddr, uint64_t range, int replicas, int leaf, const map<string, string> &entries) {
+	size_t capacity = frameCapacity(SYNC_HEADER_SIZE);
+	char header[BULK_HEADER_SIZE];
+	string payload;
+	unsigned int seq = 0;
+	auto it = entries.begin();
+	do{
+		payload.assign(BULK_HEADER_SIZE, '\0');
+		while(it != entries.end() && appendEntry(payload, it->first, it->second, capacity))
+			it++;
+		// An entry that fits no message alone cannot be compared, leave the leaf to time out
+		if(it != entries.end() && payload.size() == BULK_HEADER_SIZE){
+			log->LOG(&memberNode->addr, "Anti-entropy cannot send leaf %d, key %s with %zu bytes does not fit in a chunk",
+					leaf, it->first.c_str(), it->second.size());
+			return;
+		}
+		encodeBulkHeader(header, seq++, it == entries.end() ? BULK_LAST : 0);
+		payload.replace(0, BULK_HEADER_SIZE, header, BULK_HEADER_SIZE);
+		sendSync(toAddr, SYNC_ENTRIES, range, replicas, leaf, payload);
+	}while(it != entries.end());
+}
+
+/**
+ * FUNCTION NAME: leafEntries
+ *
+ * DESCRIPTION: Keys and values this node stores in the leaves first to last of a range,
+ * 				for the namespaces with the given N, one map per leaf. Only the tokens of
+ * 				those leaves are walked.
+ */
+vector<map<string, string>> MP2Node::leafEntries(uint64_t range, int replicas, int first, int last) {
+	vector<map<string, string>> entries(last - first + 1);
+	uint64_t from = rangeStart(range), lo, hi;
+	if(ring.tokens.empty() || !MerkleTree::leafRange(from, range, first, last, &lo, &hi))
+		return entries;
+	ht->forEachInRange(lo, hi, false, [&](const string &key, const string &value){
+		if(par->quorumFor(key).n != replicas)
+			return;
+		int leaf = MerkleTree::leafOf(hashFunction(key), from, range);
+		if(leaf >= first && leaf <= last)
+			entries[leaf - first].emplace(key, value);
+	});
+	return entries;
+}
+
+/**
+ * FUNCTION NAME: collectEntries
+ *
+ * DESCRIPTION: Record the entries a replica has in a differing leaf. The first answer for
+ * 				a leaf also asks the remaining replicas for theirs, so the leaf can be
+ * 				repaired by majority once every chunk of every replica has arrived.
+ */
+void MP2Node::collectEntries(MessageView* msg, sync_header &header) {
+	ReplicaSet replicas = ring.replicasAt(header.range, header.replicas);
+	if(replicas.empty() || !(replicas[0].nodeAddress == memberNode->addr) || !replicas.contains(msg->fromAddr))
+		return;
+
+	unsigned int seq;
+	unsigned char flags;
+	if(msg->value.size() < BULK_HEADER_SIZE || !decodeBulkHeader(msg->value.substr(0, BULK_HEADER_SIZE), &seq, &flags))
+		return;
+
+	tuple<uint64_t, int, int> id(header.range, header.replicas, header.index);
+	auto it = repairs.find(id);
+	if(it == repairs.end()){
+		leaf_repair &repair = repairs[id];
+		repair.deadline = local_time + WAIT_TIME;
+		for(auto &r : replicas){
+			if(r.nodeAddress == memberNode->addr)
+				continue;
+			repair.expected.push_back(r.nodeAddress);
+			if(!(r.nodeAddress == msg->fromAddr))
+				sendSync(&r.nodeAddress, SYNC_FETCH, header.range, header.replicas, header.index, "");
+		}
+		it = repairs.find(id);
+	}
+	leaf_repair &repair = it->second;
+	size_t p = 0;
+	while(p < repair.peers.size() && !(repair.peers[p] == msg->fromAddr))
+		p++;
+	if(p == repair.peers.size()){
+		repair.peers.push_back(msg->fromAddr);
+		repair.entries.emplace_back();
+		repair.chunks.push_back(0);
+		repair.total.push_back(0);
+	}
+	else if(repair.total[p] != 0 && repair.chunks[p] == repair.total[p]){
+		return;
+	}
+	string_view payload = msg->value.substr(BULK_HEADER_SIZE), key, value;
+	while(nextEntry(&payload, &key, &value))
+		repair.entries[p][string(key)] = string(value);
+	repair.chunks[p]++;
+	if(flags & BULK_LAST)
+		repair.total[p] = seq + 1;
+	repair.deadline = local_time + WAIT_TIME;
+	if(repair.total[p] == 0 || repair.chunks[p] != repair.total[p] || ++repair.complete < repair.expected.size())
+		return;
+	resolveRepair(header.range, header.replicas, header.index, repair);
+	repairs.erase(it);
+}
+
+/**
+ * FUNCTION NAME: resolveRepair
+ *
+ * DESCRIPTION: Vote on every key of a leaf between this node and the replicas that answered.
+ * 				A missing key votes for absence. Replicas that disagree with a strict
+ * 				majority are set to the majority value; keys without one are left alone.
+ */
+void MP2Node::resolveRepair(uint64_t range, int replicas, int leaf, leaf_repair &repair) {
+	map<string, string> own = std::move(leafEntries(range, replicas, leaf, leaf)[0]);
+	vector<map<string, string> *> votes;
+	votes.push_back(&own);
+	for(auto &e : repair.entries)
+		votes.push_back(&e);
+	int n = votes.size();
+	if(n < replicas)
+		return;
+
+	set<string> keys;
+	for(auto v : votes){
+		for(auto &elt : *v)
+			keys.insert(elt.first);
+	}
+	auto same = [](const string *a, const string *b){
+		return a == b || (a != NULL && b != NULL && *a == *b);
+	};
+	vector<const string *> vals(n);
+	int repaired = 0;
+	for(auto &key : keys){
+		for(int i = 0; i < n; i++){
+			auto f = votes[i]->find(key);
+			vals[i] = f == votes[i]->end() ? NULL : &f->second;
+		}
+		const string *majority = NULL;
+		bool found = false;
+		for(int i = 0; i < n && !found; i++){
+			int agree = 0;
+			for(int j = 0; j < n; j++)
+				agree += same(vals[i], vals[j]);
+			if(2 * agree > n){
+				majority = vals[i];
+				found = true;
+			}
+		}
+		if(!found)
+			continue;
+		string value = majority ? *majority : "";
+		for(int i = 0; i < n; i++){
+			if(!same(vals[i], majority)){
+				repairKey(i == 0 ? NULL : &repair.peers[i - 1], key, majority ? &value : NULL);
+				repaired++;
+			}
+		}
+	}
+	if(repaired > 0)
+		log->LOG(&memberNode->addr, "Anti-entropy repaired %d copies in leaf %d, the longest answer took %u chunks",
+				repaired, leaf, *max_element(repair.total.begin(), repair.total.end()));
+}
+
+/**
+ * FUNCTION NAME: repairKey
+ *
+ * DESCRIPTION: Set key to value, or delete it if value is NULL, on toAddr or on this node
+ * 				if toAddr is NULL. Repairs are not client operations and are not reported in
+ * 				dbg.log. A local repair still goes to the write-ahead log.
+ */
+void MP2Node::repairKey(Address *toAddr, const string &key, const string *value) {
+	if(toAddr == NULL){
+		if(value == NULL)
+			deletekey(key);
+		else
+			upsertKeyValue(key, *value);
+	}
+	else if(value == NULL){
+		sendMessage(toAddr, nextTransID(), DELETE, key, "", PRIMARY, MSG_REPLICA);
+	}
+	else{
+		sendMessage(toAddr, nextTransID(), UPDATE, key, *value, PRIMARY, MSG_REPLICA);
 	}
 }
@@ -8,6 +8,12 @@
 #define MP2NODE_H_
 
 #define WAIT_TIME 5
+// Times an unacknowledged BULK chunk is resent before the transfer is dropped
+#define BULK_RETRIES 3
+// Snapshot pairs a restarted node moves into memory per tick
+#define SNAPSHOT_WARM_BATCH 1024
+// Ticks a key's write version is remembered for. Hints older than this are not applied.
+#define VERSION_HORIZON 100
 
 /**
  * Header files
@@ -15,22 +21,133 @@
 #include "stdincludes.h"
 #include "EmulNet.h"
 #include "Node.h"
-#include "HashTable.h"
+#include "StorageEngine.h"
+#include "Wal.h"
+#include "WarmingTable.h"
 #include "Log.h"
 #include "Params.h"
 #include "Message.h"
 #include "Queue.h"
+#include "PendingTable.h"
+#include "Merkle.h"
+#include "MP1Node.h"
 
-struct wait_element{
-	enum MessageType msgType;
+/**
+ * STRUCT NAME: Ring
+ *
+ * DESCRIPTION: Positions of the members on the key-value ring, sorted and split into
+ * 				parallel arrays so the search only touches positions: addrs[i] is the
+ * 				member at tokens[i]. Each member holds par->VNODES positions.
+ */
+struct Ring {
+	vector<uint64_t> tokens;
+	vector<Address> addrs;
+	// Number of distinct members
+	size_t members = 0;
+	size_t lowerBound(uint64_t pos) const;
+	ReplicaSet replicasAt(uint64_t pos, int count) const;
+};
+
+/**
+ * Struct Name: leaf_repair
+ *
+ * DESCRIPTION: Entries of one leaf gathered by the primary from the other replicas of
+ * 				the range, kept until all of them have answered or the deadline passes
+ */
+typedef struct leaf_repair {
+	long long deadline;
+	vector<Address> expected;
+	vector<Address> peers;
+	// entries[i] holds the keys and values peers[i] has in the leaf
+	vector<map<string, string>> entries;
+	// SYNC_ENTRIES chunks received from peers[i], and how many it sent, 0 until the last arrives
+	vector<unsigned int> chunks;
+	vector<unsigned int> total;
+	// peers whose every chunk arrived
+	size_t complete;
+}leaf_repair;
+
+/**
+ * Struct Name: bulk_transfer
+ *
+ * DESCRIPTION: Keys being streamed to a new replica in BULK chunks. One chunk is in
+ * 				flight at a time and the next one starts where the acknowledged one ended,
+ * 				so a lost chunk or ack only resends that chunk.
+ */
+typedef struct bulk_transfer {
+	Address toAddr;
+	vector<pair<string, string>> entries;
+	// BULK_HINTED for a replay of hints
+	unsigned char flags;
+	// entries [next, end) are in the chunk in flight
+	size_t next;
+	size_t end;
+	unsigned int seq;
+	long long deadline;
+	int retries;
+}bulk_transfer;
+
+/**
+ * Struct Name: hint
+ *
+ * DESCRIPTION: Latest write to a key that a replica missed while it was suspected of failure
+ */
+typedef struct hint {
+	unsigned long long version;
+	bool deleted;
+	string value;
+}hint;
+
+/**
+ * Struct Name: read_repair
+ *
+ * DESCRIPTION: What each replica answered to a read, so the ones that returned stale
+ * 				data or nothing can be repaired once the read has a value
+ */
+typedef struct read_repair {
+	string key;
+	ReplicaSet replicas;
+	// REPLY_NONE, REPLY_MISSING or REPLY_VALUE for each replica, and the value it returned
+	unsigned char answer[MAX_REPLICAS];
+	string values[MAX_REPLICAS];
+	bool decided;
+	string winner;
+	// Repairs a BLOCKING read still waits for the REPLY of
+	int unacked;
+	long long deadline;
+}read_repair;
+
+// REPLY_REPAIRED: a BLOCKING read sent the replica a repair it has not acknowledged yet
+enum readAnswer { REPLY_NONE, REPLY_MISSING, REPLY_VALUE, REPLY_REPAIRED };
+
+/**
+ * Struct Name: held_reply
+ *
+ * DESCRIPTION: Acknowledgement of a write, sent once the write-ahead log holding the
+ * 				write has been committed
+ */
+typedef struct held_reply {
+	Address toAddr;
 	int transID;
+	MessageType type;
 	string key;
 	string value;
-	string conflicting_value;
-	int count;
-	bool should_drop;
-	long long int cur_time;
-};
+	ReplicaType replica;
+	unsigned char flags;
+}held_reply;
+
+/**
+ * Struct Name: quorum_stat
+ *
+ * DESCRIPTION: Outcomes of the client requests a coordinator ran at one quorum level.
+ * 				Latencies are in ticks and only count successful requests.
+ */
+typedef struct quorum_stat {
+	long long success;
+	long long fail;
+	long long latency;
+	long long maxLatency;
+}quorum_stat;
 
 /**
  * CLASS NAME: MP2Node
@@ -44,14 +161,25 @@ struct wait_element{
  */
 class MP2Node {
 private:
-	// Vector holding the next two neighbors in the ring who have my replicas
+	// Members that replicate the ranges this node is primary for
 	vector<Node> hasMyReplicas;
-	// Vector holding the previous two neighbors in the ring whose replicas I have
+	// Members whose primary ranges this node replicates
 	vector<Node> haveReplicasOf;
-	// Ring
-	vector<Node> ring;
-	// Hash Table
-	HashTable * ht;
+	Ring ring;
+	// Storage engine holding this node's keys, picked by par->STORAGE
+	StorageEngine * ht;
+	// Log of the writes to ht, only open when par->WAL is set
+	WriteAheadLog wal;
+	// Acknowledgements waiting for the commit of wal at the end of the tick
+	vector<held_reply> heldReplies;
+	// ht while it still reads keys from the snapshot this node restarted from, NULL after
+	WarmingTable *warming;
+	// Snapshot replacing wal every par->SNAPSHOT ticks
+	string snapshotPath;
+	long long lastSnapshot;
+	// wal.records when the last snapshot was written
+	long long snapshotRecords;
+	long long snapshots;
 	// Member representing this member
 	Member *memberNode;
 	// Params object
@@ -60,8 +188,33 @@ private:
 	EmulNet * emulNet;
 	// Object of Log
 	Log * log;
-	vector<wait_element*> waitingForReply;
+	// Client requests waiting for replies, by transID
+	PendingTable pending;
 	long long int local_time;
+	// Counter of the transIDs this node takes for its own transfers and repairs
+	unsigned int localTransID;
+	// Reusable buffer that outgoing frames are encoded into
+	vector<char> sendBuffer;
+	// Hash tree of every range this node stores keys of, by the N of the keys' namespace and
+	// then by the position ending the range. Only kept when par->ANTI_ENTROPY is set.
+	unordered_map<uint64_t, MerkleTree> trees[MAX_REPLICAS + 1];
+	// Leaves this node is repairing as primary, by range, N and leaf
+	map<tuple<uint64_t, int, int>, leaf_repair> repairs;
+	// Outgoing BULK transfers, by transfer id
+	map<int, bulk_transfer> transfers;
+	// Writes held for suspected replicas, by the replica's address bytes and then by key.
+	// A replica keeps its hints until the membership list shows it alive again.
+	map<string, map<string, hint>> hints;
+	// Version of the last client write or hint applied to each key in the past
+	// VERSION_HORIZON ticks, so an older hint cannot overwrite a newer write
+	unordered_map<string, unsigned long long> writeVersions;
+	long long lastVersionPrune;
+	// Reads checked for stale replicas, by transID
+	map<int, read_repair> readRepairs;
+	// Chooses the reads PROBABILISTIC read repair checks
+	Random rng;
+	// Requests this node coordinated, by [read][N][R or W]
+	quorum_stat quorumStats[2][MAX_REPLICAS + 1][MAX_REPLICAS + 1];
 
 public:
 	MP2Node(Member *memberNode, Params *par, EmulNet *emulNet, Log *log, Address *addressOfMember);
@@ -72,14 +225,33 @@ public:
 	// ring functionalities
 	void updateRing();
 	vector<Node> getMembershipList();
-	size_t hashFunction(string key);
+	uint64_t hashFunction(string_view key);
 	void findNeighbors();
+	void buildRing(vector<Node> &members, Ring &next);
 
-	// client side CRUD APIs
-	void clientCreate(string key, string value);
-	void clientRead(string key);
-	void clientUpdate(string key, string value);
-	void clientDelete(string key);
+	// client side CRUD APIs. A quorum of 0 uses the R or W of the key's namespace.
+	void clientCreate(string key, string value, int quorum = 0);
+	void clientRead(string key, int quorum = 0);
+	void clientUpdate(string key, string value, int quorum = 0);
+	void clientDelete(string key, int quorum = 0);
+	wait_element *startRequest(MessageType type, int transID, const string &key, int replicas, int needed);
+	void completeRequest(wait_element *WE, bool success, const string *value);
+	quorum_stat &getQuorumStat(int read, int n, int needed) {
+		return quorumStats[read][n][needed];
+	}
+
+	// transID for a transfer or repair this node starts
+	int nextTransID();
+	// bytes of value one message carries next to a key of keySize bytes
+	size_t frameCapacity(size_t keySize);
+	// whether a key and value fit as one entry in every kind of chunk
+	bool fitsInChunk(string_view key, string_view value);
+	// encode a message and send it through Emulnet
+	int sendMessage(Address *toAddr, int transID, MessageType type, string_view key, string_view value,
+			ReplicaType replica = PRIMARY, unsigned char flags = 0);
+	// send the acknowledgement of a write once the write is logged
+	void sendAck(Address *toAddr, int transID, MessageType type, string_view key, string_view value,
+			ReplicaType replica = PRIMARY, unsigned char flags = 0);
 
 	// receive messages from Emulnet
 	bool recvLoop();
@@ -92,24 +264,85 @@ public:
 	void dispatchMessages(Message message);
 
 	// find the addresses of nodes that are responsible for a key
-	vector<Node> findNodes(string key);
+	ReplicaSet findNodes(const string &key);
+
+	// number of keys this node stores, as primary or replica
+	unsigned long keyCount();
+	size_t storageBytes();
+	const char *storageName();
 
 	// server
-	bool createKeyValue(string key, string value, ReplicaType replica);
-	string readKey(string key);
-	bool updateKeyValue(string key, string value, ReplicaType replica);
-	bool deletekey(string key);
+	bool createKeyValue(string_view key, string value, ReplicaType replica);
+	const string *readKey(string_view key);
+	bool updateKeyValue(string_view key, string value, ReplicaType replica);
+	void upsertKeyValue(string_view key, string value);
+	bool deletekey(string_view key);
+
+	// write-ahead log
+	void openWal(Address *address);
+	void commitWal();
+	WriteAheadLog &getWal() {
+		return wal;
+	}
+
+	// snapshots
+	bool writeSnapshot();
+	void warmUp();
+	long long getSnapshots() {
+		return snapshots;
+	}
 
 	// stabilization protocol - handle multiple failures
-	void stabilizationProtocol();
+	void stabilizationProtocol(Ring &oldRing);
+
+	// streaming keys to new replicas
+	void startTransfer(bulk_transfer &transfer);
+	bool sendChunk(int id, bulk_transfer &transfer);
+	void endTransfer(int id, bulk_transfer &transfer, bool done);
+	void handleBulk(MessageView* msg);
+	void handleBulkAck(MessageView* msg);
+	void resendChunks();
+
+	// hinted handoff for writes to suspected replicas
+	MemberListEntry *findMember(Address &addr);
+	bool isSuspected(Address &addr);
+	void addHints(ReplicaSet &replicas, int transID, const string &key, const string &value, bool deleted);
+	void replayHints();
+	void applyHint(string_view key, string_view data);
+	void dropHint(Address &target, const string &key, int transID);
+	unsigned long long writeVersion(int transID);
+	void noteWrite(string_view key, int transID);
+	void pruneVersions();
+
+	// read repair
+	void noteReadReply(MessageView* msg);
+	bool holdRead(wait_element *WE, const string &winner);
+	void repairAcked(wait_element *WE, MessageView* msg);
+	void finishRead(int transID, const string *winner);
+	void repairRead(read_repair &repair);
+	void expireReadRepairs();
+
+	// anti-entropy between the replicas of each range
+	uint64_t rangeOf(string_view key, int *leaf);
+	uint64_t rangeStart(uint64_t range);
+	void treeToggle(string_view key, string_view value);
+	void rebuildTrees();
+	void antiEntropy();
+	void handleSync(MessageView* msg);
+	void sendSync(Address *toAddr, int stage, uint64_t range, int replicas, int index, string_view payload);
+	void sendEntries(Address *toAddr, uint64_t range, int replicas, int leaf, const map<string, string> &entries);
+	vector<map<string, string>> leafEntries(uint64_t range, int replicas, int first, int last);
+	void collectEntries(MessageView* msg, sync_header &header);
+	void resolveRepair(uint64_t range, int replicas, int leaf, leaf_repair &repair);
+	void repairKey(Address *toAddr, const string &key, const string *value);
 
 	void cleanUpWait();
-	void handleReply(Message* msg);
-	void handleReplyRead(Message* msg);
-	void handleCreate(Message* msg);
-	void handleRead(Message* msg);
-	void handleUpdate(Message* msg);
-	void handleDelete(Message* msg);
+	void handleReply(MessageView* msg);
+	void handleReplyRead(MessageView* msg);
+	void handleCreate(MessageView* msg);
+	void handleRead(MessageView* msg);
+	void handleUpdate(MessageView* msg);
+	void handleDelete(MessageView* msg);
 
 	~MP2Node();
 };
@@ -0,0 +1,156 @@
+/**********************************
+ * FILE NAME: MapTable.cpp
+ *
+ * DESCRIPTION: Definition of MapTable
+ **********************************/
+
+#include "MapTable.h"
+
+const char *MapTable::name() {
+	return "map";
+}
+
+/**
+ * FUNCTION NAME: create
+ *
+ * DESCRIPTION: Insert (key, value) unless the key is present. The search leaves a hint
+ * 				where the key belongs, so inserting does not search again.
+ */
+const string *MapTable::create(string_view key, string value) {
+	auto it = table.lower_bound(key);
+	if ( it != table.end() && it->first == key ) {
+		return NULL;
+	}
+	return &table.emplace_hint(it, string(key), std::move(value))->second;
+}
+
+/**
+ * FUNCTION NAME: createMany
+ *
+ * DESCRIPTION: Insert the pairs whose key is not present yet. Pairs sorted by key are
+ * 				inserted next to the previous one instead of searching from the root.
+ * 				entries is left holding only the pairs that were inserted.
+ */
+void MapTable::createMany(vector<pair<string, string>> &entries) {
+	auto hint = table.begin();
+	size_t kept = 0;
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		size_t before = table.size();
+		hint = next(table.emplace_hint(hint, entries[i].first, entries[i].second));
+		if ( table.size() != before ) {
+			if ( kept != i ) {
+				entries[kept] = std::move(entries[i]);
+			}
+			kept++;
+		}
+	}
+	entries.resize(kept);
+}
+
+/**
+ * FUNCTION NAME: read
+ *
+ * DESCRIPTION: The stored value of key, NULL if it is absent
+ */
+const string *MapTable::read(string_view key) {
+	auto it = table.find(key);
+	return it != table.end() ? &it->second : NULL;
+}
+
+/**
+ * FUNCTION NAME: update
+ *
+ * DESCRIPTION: Replace the value of key if it is present, moving the old one to oldValue
+ * 				unless it is NULL
+ */
+const string *MapTable::update(string_view key, string newValue, string *oldValue) {
+	auto it = table.find(key);
+	if ( it == table.end() ) {
+		return NULL;
+	}
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(it->second);
+	}
+	it->second = std::move(newValue);
+	return &it->second;
+}
+
+/**
+ * FUNCTION NAME: upsert
+ *
+ * DESCRIPTION: Set key to value whether or not it is present, moving a replaced value to
+ * 				oldValue unless it is NULL
+ *
+ * RETURNS:
+ * true if the key was present
+ */
+bool MapTable::upsert(string_view key, string value, string *oldValue) {
+	auto it = table.lower_bound(key);
+	if ( it == table.end() || it->first != key ) {
+		table.emplace_hint(it, string(key), std::move(value));
+		return false;
+	}
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(it->second);
+	}
+	it->second = std::move(value);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: deleteKey
+ *
+ * DESCRIPTION: Remove key, moving its value to oldValue unless it is NULL
+ */
+bool MapTable::deleteKey(string_view key, string *oldValue) {
+	auto it = table.find(key);
+	if ( it == table.end() ) {
+		return false;
+	}
+	if ( oldValue != NULL ) {
+		*oldValue = std::move(it->second);
+	}
+	table.erase(it);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: forEach
+ *
+ * DESCRIPTION: Visit every pair in key order
+ */
+void MapTable::forEach(const visitor &visit) {
+	for ( auto &elt : table ) {
+		visit(elt.first, elt.second);
+	}
+}
+
+unsigned long MapTable::currentSize() {
+	return table.size();
+}
+
+/**
+ * FUNCTION NAME: memoryUsage
+ *
+ * DESCRIPTION: Bytes held by the tree nodes and by the strings they store
+ */
+size_t MapTable::memoryUsage() {
+	size_t bytes = table.size() * (sizeof(pair<const string, string>) + MAPTABLE_NODE_OVERHEAD + MAPTABLE_MALLOC_OVERHEAD);
+	for ( auto &elt : table ) {
+		bytes += stringBytes(elt.first) + stringBytes(elt.second);
+	}
+	return bytes;
+}
+
+void MapTable::clear() {
+	table.clear();
+}
+
+/**
+ * FUNCTION NAME: snapshot
+ *
+ * DESCRIPTION: Copy every pair into entries, which comes out sorted without a sort
+ */
+void MapTable::snapshot(vector<pair<string, string>> &entries) {
+	entries.assign(table.begin(), table.end());
+}
@@ -0,0 +1,43 @@
+/**********************************
+ * FILE NAME: MapTable.h
+ *
+ * DESCRIPTION: Storage engine over std::map, header file
+ **********************************/
+
+#ifndef MAPTABLE_H_
+#define MAPTABLE_H_
+
+#include "stdincludes.h"
+#include "StorageEngine.h"
+
+// Bytes of a red-black tree node besides its pair: colour, parent, left, right
+#define MAPTABLE_NODE_OVERHEAD 32
+// Bytes malloc adds to every node
+#define MAPTABLE_MALLOC_OVERHEAD 16
+
+/**
+ * CLASS NAME: MapTable
+ *
+ * DESCRIPTION: Storage engine that keeps the pairs in a std::map ordered by key, with
+ * 				one heap node per pair. It is the store the KV nodes used before HashTable,
+ * 				kept so the two can be benchmarked against each other.
+ */
+class MapTable : public StorageEngine {
+private:
+	map<string, string, less<>> table;
+public:
+	const char *name();
+	const string *create(string_view key, string value);
+	void createMany(vector<pair<string, string>> &entries);
+	const string *read(string_view key);
+	const string *update(string_view key, string newValue, string *oldValue = NULL);
+	bool upsert(string_view key, string value, string *oldValue = NULL);
+	bool deleteKey(string_view key, string *oldValue = NULL);
+	void forEach(const visitor &visit);
+	unsigned long currentSize();
+	size_t memoryUsage();
+	void clear();
+	void snapshot(vector<pair<string, string>> &entries);
+};
+
+#endif /* MAPTABLE_H_ */
@@ -0,0 +1,127 @@
+/**********************************
+ * FILE NAME: Merkle.cpp
+ *
+ * DESCRIPTION: Definition of MerkleTree and of the SYNC message helpers
+ **********************************/
+
+#include "Merkle.h"
+
+/**
+ * Constructor
+ */
+MerkleTree::MerkleTree(): root(0) {
+	memset(mids, 0, sizeof(mids));
+	memset(leaves, 0, sizeof(leaves));
+}
+
+/**
+ * FUNCTION NAME: toggle
+ *
+ * DESCRIPTION: XOR the hash of an entry into its leaf and every node above it
+ */
+void MerkleTree::toggle(int leaf, string_view key, string_view value) {
+	uint64_t h = entryHash(key, value);
+	leaves[leaf] ^= h;
+	mids[leaf / MERKLE_FANOUT] ^= h;
+	root ^= h;
+}
+
+/**
+ * Tokens in each leaf of the ring range (from, to], from == to being the whole ring
+ */
+static uint64_t leafSpan(uint64_t from, uint64_t to) {
+	return (to - from - 1) / MERKLE_LEAVES + 1;
+}
+
+/**
+ * FUNCTION NAME: leafOf
+ *
+ * DESCRIPTION: Leaf of a token in the range (from, to]
+ */
+int MerkleTree::leafOf(uint64_t token, uint64_t from, uint64_t to) {
+	return (int)((token - from - 1) / leafSpan(from, to));
+}
+
+/**
+ * FUNCTION NAME: leafRange
+ *
+ * DESCRIPTION: Tokens (lo, hi] of the leaves first to last of the range (from, to]
+ *
+ * RETURNS:
+ * false if the range is too narrow to give those leaves any token
+ */
+bool MerkleTree::leafRange(uint64_t from, uint64_t to, int first, int last, uint64_t *lo, uint64_t *hi) {
+	uint64_t span = leafSpan(from, to), width = to - from - 1;
+	if ( (uint64_t)first * span > width ) {
+		return false;
+	}
+	*lo = from + (uint64_t)first * span;
+	if ( last >= MERKLE_LEAVES - 1 || ((uint64_t)last + 1) * span > width ) {
+		*hi = to;
+	}
+	else {
+		*hi = from + ((uint64_t)last + 1) * span;
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: entryHash
+ *
+ * DESCRIPTION: Hash of a key together with its value
+ */
+uint64_t MerkleTree::entryHash(string_view key, string_view value) {
+	return hash64(value, hash64(key));
+}
+
+/**
+ * FUNCTION NAME: encodeSyncHeader
+ *
+ * DESCRIPTION: Write header into buffer, which must hold SYNC_HEADER_SIZE bytes
+ */
+int encodeSyncHeader(char *buffer, sync_header &header) {
+	buffer[0] = (char)(header.stage | (header.replicas << 4));
+	for ( int i = 0; i < 8; i++ ) {
+		buffer[1 + i] = (char)(header.range >> (8 * i));
+	}
+	buffer[9] = (char)(header.index & 0xff);
+	buffer[10] = (char)((header.index >> 8) & 0xff);
+	return SYNC_HEADER_SIZE;
+}
+
+/**
+ * FUNCTION NAME: decodeSyncHeader
+ *
+ * DESCRIPTION: Parse the key field of a SYNC message
+ */
+bool decodeSyncHeader(string_view key, sync_header *header) {
+	const unsigned char *p = (const unsigned char *)key.data();
+	if ( key.size() != SYNC_HEADER_SIZE || (p[0] & 0x0f) > SYNC_FETCH ) {
+		return false;
+	}
+	header->stage = p[0] & 0x0f;
+	header->replicas = p[0] >> 4;
+	header->range = hashRead8(p + 1);
+	header->index = p[9] | (p[10] << 8);
+	return header->index < MERKLE_LEAVES;
+}
+
+/**
+ * FUNCTION NAME: appendHash
+ *
+ * DESCRIPTION: Append a hash to a payload of SYNC_MIDS or SYNC_LEAVES
+ */
+void appendHash(string &payload, uint64_t hash) {
+	for ( int i = 0; i < 8; i++ ) {
+		payload.push_back((char)(hash >> (8 * i)));
+	}
+}
+
+/**
+ * FUNCTION NAME: readHash
+ *
+ * DESCRIPTION: The i-th hash of a payload, the caller checks the payload size
+ */
+uint64_t readHash(string_view payload, int i) {
+	return hashRead8((const unsigned char *)payload.data() + 8 * i);
+}
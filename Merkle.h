@@ -0,0 +1,73 @@
+/**********************************
+ * FILE NAME: Merkle.h
+ *
+ * DESCRIPTION: Hash tree over the keys of one ring range, and the encoding of the
+ * 				SYNC messages replicas use to compare their trees
+ **********************************/
+
+#ifndef _MERKLE_H_
+#define _MERKLE_H_
+
+#include "stdincludes.h"
+#include "Hash.h"
+#include "Message.h"
+
+#define MERKLE_FANOUT 16
+#define MERKLE_LEAVES (MERKLE_FANOUT * MERKLE_FANOUT)
+// Bytes of the SYNC header carried in the key field: stage and replica count, range, index
+#define SYNC_HEADER_SIZE 11
+
+/*
+ * Stages of an anti-entropy exchange. A range has one tree per replica count N in use,
+ * holding the keys of the namespaces with that N. The primary of a range sends each root
+ * to the other N - 1 replicas, and each round trip narrows the comparison down one level:
+ *   SYNC_ROOT     primary -> replica   root of the range
+ *   SYNC_MIDS     replica -> primary   the replica's 16 interior hashes, if the roots differ
+ *   SYNC_LEAVES   primary -> replica   the primary's 16 leaf hashes under one differing interior node
+ *   SYNC_ENTRIES  replica -> primary   the replica's keys and values in one differing leaf, in
+ *                                      chunks with a BULK header: seq, and BULK_LAST on the last
+ *   SYNC_FETCH    primary -> replica   ask for SYNC_ENTRIES of a leaf, to get the third vote
+ */
+enum SyncStage {SYNC_ROOT, SYNC_MIDS, SYNC_LEAVES, SYNC_ENTRIES, SYNC_FETCH};
+
+/**
+ * CLASS NAME: MerkleTree
+ *
+ * DESCRIPTION: Two level hash tree with fanout 16 over the entries of one range. Every
+ * 				node is the XOR of the entry hashes below it, so adding or removing an
+ * 				entry updates a leaf, its parent and the root in constant time. The leaves
+ * 				split the tokens of the range into MERKLE_LEAVES equal spans, so the keys
+ * 				of a leaf, or of an interior node, are those of one token range.
+ */
+class MerkleTree {
+public:
+	uint64_t root;
+	uint64_t mids[MERKLE_FANOUT];
+	uint64_t leaves[MERKLE_LEAVES];
+	MerkleTree();
+	// add the entry if it is absent, remove it if it is present
+	void toggle(int leaf, string_view key, string_view value);
+	static int leafOf(uint64_t token, uint64_t from, uint64_t to);
+	static bool leafRange(uint64_t from, uint64_t to, int first, int last, uint64_t *lo, uint64_t *hi);
+	static uint64_t entryHash(string_view key, string_view value);
+};
+
+/**
+ * Struct Name: sync_header
+ *
+ * DESCRIPTION: Key field of a SYNC message. replicas picks the tree of the range, and
+ * 				index is an interior node for SYNC_LEAVES and a leaf for SYNC_ENTRIES and SYNC_FETCH.
+ */
+typedef struct sync_header {
+	int stage;
+	int replicas;
+	uint64_t range;
+	int index;
+}sync_header;
+
+int encodeSyncHeader(char *buffer, sync_header &header);
+bool decodeSyncHeader(string_view key, sync_header *header);
+void appendHash(string &payload, uint64_t hash);
+uint64_t readHash(string_view payload, int i);
+
+#endif /* _MERKLE_H_ */
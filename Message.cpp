@@ -52,6 +52,8 @@ Message::Message(string message){
 		case READREPLY:
 			value = tuple.at(3);
 			break;
+		default:
+			break;
 	}
 }
 
@@ -67,6 +69,7 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
 	key = _key;
 	value = _value;
 	replica = _replica;
+	success = false;
 }
 
 /**
@@ -93,6 +96,8 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
 	type = _type;
 	key = _key;
 	value = _value;
+	replica = PRIMARY;
+	success = false;
 }
 
 /**
@@ -105,6 +110,8 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, string _key
 	fromAddr = _fromAddr;
 	type = _type;
 	key = _key;
+	replica = PRIMARY;
+	success = false;
 }
 
 /**
@@ -117,6 +124,7 @@ Message::Message(int _transID, Address _fromAddr, MessageType _type, bool _succe
 	fromAddr = _fromAddr;
 	type = _type;
 	success = _success;
+	replica = PRIMARY;
 }
 
 /**
@@ -129,6 +137,8 @@ Message::Message(int _transID, Address _fromAddr, string _value){
 	fromAddr = _fromAddr;
 	type = READREPLY;
 	value = _value;
+	replica = PRIMARY;
+	success = false;
 }
 
 /**
@@ -156,6 +166,8 @@ string Message::toString(){
 		case READREPLY:
 			message += value;
 			break;
+		default:
+			break;
 	}
 	return message;
 }
@@ -174,3 +186,229 @@ Message& Message::operator =(const Message& anotherMessage) {
 	this->value = anotherMessage.value;
 	return *this;
 }
+
+/**
+ * FUNCTION NAME: encodedSize
+ *
+ * DESCRIPTION: Number of bytes encode() needs for a frame with this key and value
+ */
+int Message::encodedSize(string_view key, string_view value) {
+	return MESSAGE_HEADER_SIZE + varintSize(key.size()) + key.size() + varintSize(value.size()) + value.size();
+}
+
+/**
+ * FUNCTION NAME: trafficType
+ *
+ * DESCRIPTION: MessageType of an encoded frame, or MESSAGE_TRAFFIC_REPLICA for a stabilization
+ * 				push or repair write so it can be told apart from client writes. -1 if it is not a frame.
+ */
+int Message::trafficType(const char *data, int size) {
+	const unsigned char *p = (const unsigned char *)data;
+	if ( size < MESSAGE_HEADER_SIZE || p[0] != MESSAGE_WIRE_VERSION || p[1] > BULKACK ) {
+		return -1;
+	}
+	if ( (p[3] & MSG_REPLICA) && (p[1] == CREATE || p[1] == UPDATE || p[1] == DELETE) ) {
+		return MESSAGE_TRAFFIC_REPLICA;
+	}
+	return p[1];
+}
+
+/**
+ * FUNCTION NAME: trafficTypeName
+ *
+ * DESCRIPTION: Name of a type returned by trafficType
+ */
+const char *Message::trafficTypeName(int type) {
+	static const char *names[] = {"CREATE", "READ", "UPDATE", "DELETE", "REPLY", "READREPLY", "SYNC", "BULK", "BULKACK", "REPLICA"};
+	return names[type];
+}
+
+/**
+ * FUNCTION NAME: encode
+ *
+ * DESCRIPTION: Write one frame in the binary wire format into buffer
+ *
+ * RETURNS:
+ * number of bytes written, or -1 if the frame does not fit in capacity
+ */
+int Message::encode(char *buffer, int capacity, int transID, Address &fromAddr, MessageType type,
+		ReplicaType replica, unsigned char flags, string_view key, string_view value) {
+	if ( encodedSize(key, value) > capacity ) {
+		return -1;
+	}
+	char *p = buffer;
+	unsigned int id = (unsigned int)transID;
+	p[0] = MESSAGE_WIRE_VERSION;
+	p[1] = (char)type;
+	p[2] = (char)replica;
+	p[3] = (char)flags;
+	p[4] = (char)(id & 0xff);
+	p[5] = (char)((id >> 8) & 0xff);
+	p[6] = (char)((id >> 16) & 0xff);
+	p[7] = (char)((id >> 24) & 0xff);
+	memcpy(p + 8, fromAddr.addr, sizeof(fromAddr.addr));
+	p += MESSAGE_HEADER_SIZE;
+	p += putVarint(p, key.size());
+	memcpy(p, key.data(), key.size());
+	p += key.size();
+	p += putVarint(p, value.size());
+	memcpy(p, value.data(), value.size());
+	p += value.size();
+	return p - buffer;
+}
+
+/**
+ * FUNCTION NAME: encodeBulkHeader
+ *
+ * DESCRIPTION: Write the key field of a BULK or BULKACK message into buffer, which must
+ * 				hold BULK_HEADER_SIZE bytes
+ */
+int encodeBulkHeader(char *buffer, unsigned int seq, unsigned char flags) {
+	buffer[0] = (char)(seq & 0xff);
+	buffer[1] = (char)((seq >> 8) & 0xff);
+	buffer[2] = (char)((seq >> 16) & 0xff);
+	buffer[3] = (char)((seq >> 24) & 0xff);
+	buffer[4] = (char)flags;
+	return BULK_HEADER_SIZE;
+}
+
+/**
+ * FUNCTION NAME: decodeBulkHeader
+ *
+ * DESCRIPTION: Parse the key field of a BULK or BULKACK message
+ */
+bool decodeBulkHeader(string_view key, unsigned int *seq, unsigned char *flags) {
+	const unsigned char *p = (const unsigned char *)key.data();
+	if ( key.size() != BULK_HEADER_SIZE ) {
+		return false;
+	}
+	*seq = (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+	*flags = p[4];
+	return true;
+}
+
+/**
+ * FUNCTION NAME: encodeHintValue
+ *
+ * DESCRIPTION: Value of a hinted BULK entry: the version and kind of the missed write, then its value
+ */
+string encodeHintValue(unsigned long long version, bool deleted, string_view value) {
+	string data(HINT_META_SIZE, '\0');
+	for ( int i = 0; i < 8; i++ ) {
+		data[i] = (char)(version >> (8 * i));
+	}
+	data[8] = deleted ? 1 : 0;
+	data.append(value);
+	return data;
+}
+
+/**
+ * FUNCTION NAME: decodeHintValue
+ *
+ * DESCRIPTION: Parse the value of a hinted BULK entry, value refers to data
+ */
+bool decodeHintValue(string_view data, unsigned long long *version, bool *deleted, string_view *value) {
+	const unsigned char *p = (const unsigned char *)data.data();
+	if ( data.size() < HINT_META_SIZE ) {
+		return false;
+	}
+	*version = 0;
+	for ( int i = 0; i < 8; i++ ) {
+		*version |= (unsigned long long)p[i] << (8 * i);
+	}
+	*deleted = p[8] != 0;
+	*value = data.substr(HINT_META_SIZE);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: appendEntry
+ *
+ * DESCRIPTION: Append a key and value to an entry list, the payload of SYNC_ENTRIES and BULK
+ *
+ * RETURNS:
+ * false, leaving the payload unchanged, if the payload would grow past capacity
+ */
+bool appendEntry(string &payload, string_view key, string_view value, size_t capacity) {
+	char len[MESSAGE_MAX_VARINT];
+	if ( payload.size() + varintSize(key.size()) + key.size() + varintSize(value.size()) + value.size() > capacity ) {
+		return false;
+	}
+	payload.append(len, putVarint(len, key.size()));
+	payload.append(key);
+	payload.append(len, putVarint(len, value.size()));
+	payload.append(value);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: nextEntry
+ *
+ * DESCRIPTION: Take the first key and value off an entry list
+ *
+ * RETURNS:
+ * false at the end of the payload or if it is malformed
+ */
+bool nextEntry(string_view *payload, string_view *key, string_view *value) {
+	const unsigned char *p = (const unsigned char *)payload->data();
+	const unsigned char *end = p + payload->size();
+	unsigned int len;
+	int n;
+
+	if ( (n = getVarint(p, end, &len)) < 0 || len > (unsigned int)(end - p - n) ) {
+		return false;
+	}
+	p += n;
+	*key = string_view((const char *)p, len);
+	p += len;
+	if ( (n = getVarint(p, end, &len)) < 0 || len > (unsigned int)(end - p - n) ) {
+		return false;
+	}
+	p += n;
+	*value = string_view((const char *)p, len);
+	p += len;
+	payload->remove_prefix(p - (const unsigned char *)payload->data());
+	return true;
+}
+
+/**
+ * FUNCTION NAME: decode
+ *
+ * DESCRIPTION: Parse a frame produced by Message::encode. No bytes are copied,
+ * 				key and value refer to data.
+ *
+ * RETURNS:
+ * true if the frame is well formed
+ */
+bool MessageView::decode(const char *data, int size) {
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + size;
+	unsigned int len;
+	int n;
+
+	if ( size < MESSAGE_HEADER_SIZE || p[0] != MESSAGE_WIRE_VERSION ) {
+		return false;
+	}
+	type = static_cast<MessageType>(p[1]);
+	replica = static_cast<ReplicaType>(p[2]);
+	success = (p[3] & MSG_SUCCESS) != 0;
+	isReplica = (p[3] & MSG_REPLICA) != 0;
+	wantsAck = (p[3] & MSG_ACK) != 0;
+	transID = (int)((unsigned int)p[4] | ((unsigned int)p[5] << 8) | ((unsigned int)p[6] << 16) | ((unsigned int)p[7] << 24));
+	memcpy(fromAddr.addr, p + 8, sizeof(fromAddr.addr));
+	p += MESSAGE_HEADER_SIZE;
+
+	if ( (n = getVarint(p, end, &len)) < 0 || len > (unsigned int)(end - p - n) ) {
+		return false;
+	}
+	p += n;
+	key = string_view((const char *)p, len);
+	p += len;
+
+	if ( (n = getVarint(p, end, &len)) < 0 || len > (unsigned int)(end - p - n) ) {
+		return false;
+	}
+	p += n;
+	value = string_view((const char *)p, len);
+	return true;
+}
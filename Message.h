@@ -10,6 +10,94 @@
 #include "Member.h"
 #include "common.h"
 
+/*
+ * Wire format of an encoded Message (all integers little endian):
+ *
+ *   byte  0      MESSAGE_WIRE_VERSION
+ *   byte  1      MessageType
+ *   byte  2      ReplicaType
+ *   byte  3      flags (MSG_SUCCESS, MSG_REPLICA, MSG_ACK)
+ *   bytes 4-7    transID
+ *   bytes 8-13   fromAddr
+ *   varint       key length, followed by the key bytes
+ *   varint       value length, followed by the value bytes
+ */
+#define MESSAGE_WIRE_VERSION 1
+#define MESSAGE_HEADER_SIZE 14
+// Largest encoding of a 32 bit varint
+#define MESSAGE_MAX_VARINT 5
+
+// MSG_ACK asks the receiver of a replica write to REPLY once it is applied
+enum MessageFlags {MSG_SUCCESS = 1, MSG_REPLICA = 2, MSG_ACK = 4};
+// Traffic class of stabilization pushes and repairs, numbered after the MessageType values
+#define MESSAGE_TRAFFIC_REPLICA (BULKACK + 1)
+// Bytes of the BULK header carried in the key field: chunk sequence number, BulkFlags
+#define BULK_HEADER_SIZE 5
+// Bytes in front of the value of a hinted BULK entry: version, deleted flag
+#define HINT_META_SIZE 9
+
+// BULK_HINTED chunks carry versioned hints to overwrite with, instead of keys to add
+enum BulkFlags {BULK_LAST = 1, BULK_HINTED = 2};
+
+/*
+ * Varint helpers for the wire format
+ */
+static inline int putVarint(char *p, unsigned int v) {
+	int n = 0;
+	while ( v >= 0x80 ) {
+		p[n++] = (char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char)v;
+	return n;
+}
+
+static inline int getVarint(const unsigned char *p, const unsigned char *end, unsigned int *v) {
+	unsigned int result = 0;
+	int n = 0;
+	for ( int shift = 0; shift < 7 * MESSAGE_MAX_VARINT && p + n < end; shift += 7 ) {
+		unsigned char b = p[n++];
+		result |= (unsigned int)(b & 0x7f) << shift;
+		if ( !(b & 0x80) ) {
+			*v = result;
+			return n;
+		}
+	}
+	return -1;
+}
+
+static inline int varintSize(unsigned int v) {
+	int n = 1;
+	while ( v >= 0x80 ) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * CLASS NAME: MessageView
+ *
+ * DESCRIPTION: A decoded frame. key and value point into the received buffer,
+ * 				so the view is only valid while that buffer is alive.
+ */
+class MessageView{
+public:
+	MessageType type;
+	ReplicaType replica;
+	int transID;
+	bool success;
+	// push from the stabilization protocol or a repair, not a client request
+	bool isReplica;
+	// the sender of a replica write waits for its REPLY
+	bool wantsAck;
+	Address fromAddr;
+	string_view key;
+	string_view value;
+	// parse a frame, returns false if it is truncated or malformed
+	bool decode(const char *data, int size);
+};
+
 /**
  * CLASS NAME: Message
  *
@@ -41,6 +129,21 @@ public:
 	Message& operator = (const Message& anotherMessage);
 	// serialize to a string
 	string toString();
+	// serialize to the binary wire format
+	static int encode(char *buffer, int capacity, int transID, Address &fromAddr, MessageType type,
+			ReplicaType replica, unsigned char flags, string_view key, string_view value);
+	static int encodedSize(string_view key, string_view value);
+	// classify an encoded frame for the traffic accounting of EmulNet
+	static int trafficType(const char *data, int size);
+	static const char *trafficTypeName(int type);
 };
 
+int encodeBulkHeader(char *buffer, unsigned int seq, unsigned char flags);
+bool decodeBulkHeader(string_view key, unsigned int *seq, unsigned char *flags);
+string encodeHintValue(unsigned long long version, bool deleted, string_view value);
+bool decodeHintValue(string_view data, unsigned long long *version, bool *deleted, string_view *value);
+// lists of keys and values carried in one frame
+bool appendEntry(string &payload, string_view key, string_view value, size_t capacity);
+bool nextEntry(string_view *payload, string_view *key, string_view *value);
+
 #endif
@@ -19,6 +19,14 @@ Node::Node(Address address) {
 	computeHashCode();
 }
 
+/**
+ * constructor, for a node whose position on the ring is already known
+ */
+Node::Node(Address address, uint64_t hashCode) {
+	this->nodeAddress = address;
+	this->nodeHashCode = hashCode;
+}
+
 /**
  * Destructor
  */
@@ -30,7 +38,17 @@ Node::~Node() {}
  * DESCRIPTION: This function computes the hash code of the node address
  */
 void Node::computeHashCode() {
-	nodeHashCode = hashFunc(nodeAddress.addr)%RING_SIZE;
+	nodeHashCode = tokenOf(nodeAddress, 0);
+}
+
+/**
+ * FUNCTION NAME: tokenOf
+ *
+ * DESCRIPTION: Position on the ring of the given virtual node of a member. Virtual
+ * 				node 0 is the member's own position.
+ */
+uint64_t Node::tokenOf(Address &address, int vnode) {
+	return hash64(address.addr, sizeof(address.addr), vnode);
 }
 
 /**
@@ -62,7 +80,7 @@ bool Node::operator < (const Node& another) const {
  *
  * DESCRIPTION: return hash code of the node
  */
-size_t Node::getHashCode() {
+uint64_t Node::getHashCode() {
 	return nodeHashCode;
 }
 
@@ -80,7 +98,7 @@ Address * Node::getAddress() {
  *
  * DESCRIPTION: set the hash code of the node
  */
-void Node::setHashCode(size_t hashCode) {
+void Node::setHashCode(uint64_t hashCode) {
 	this->nodeHashCode = hashCode;
 }
 
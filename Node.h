@@ -9,23 +9,75 @@
 
 #include "stdincludes.h"
 #include "Member.h"
+#include "Hash.h"
+
+// Largest replica set findNodes can return, the highest N a namespace can use
+#define MAX_REPLICAS 5
 
 class Node {
 public:
 	Address nodeAddress;
-	size_t nodeHashCode;
-	std::hash<string> hashFunc;
+	uint64_t nodeHashCode;
 	Node();
 	Node(Address address);
+	Node(Address address, uint64_t hashCode);
+	static uint64_t tokenOf(Address &address, int vnode);
 	Node(const Node& another);
 	Node& operator=(const Node& another);
 	bool operator < (const Node& another) const;
 	void computeHashCode();
-	size_t getHashCode();
+	uint64_t getHashCode();
 	Address * getAddress();
-	void setHashCode(size_t hashCode);
+	void setHashCode(uint64_t hashCode);
 	void setAddress(Address address);
 	virtual ~Node();
 };
 
+/**
+ * CLASS NAME: ReplicaSet
+ *
+ * DESCRIPTION: The replicas of a key, primary first. Fixed capacity and held by
+ * 				value, so looking up replicas never allocates.
+ */
+class ReplicaSet {
+public:
+	Node nodes[MAX_REPLICAS];
+	int count;
+	ReplicaSet(): count(0) {}
+	int size() const {
+		return count;
+	}
+	bool empty() const {
+		return count == 0;
+	}
+	void clear() {
+		count = 0;
+	}
+	bool contains(Address &address) {
+		for ( int i = 0; i < count; i++ ) {
+			if ( nodes[i].nodeAddress == address ) {
+				return true;
+			}
+		}
+		return false;
+	}
+	void push_back(const Node &node) {
+		assert(count < MAX_REPLICAS);
+		nodes[count++] = node;
+	}
+	Node& at(int i) {
+		assert(i >= 0 && i < count);
+		return nodes[i];
+	}
+	Node& operator[](int i) {
+		return nodes[i];
+	}
+	Node *begin() {
+		return nodes;
+	}
+	Node *end() {
+		return nodes + count;
+	}
+};
+
 #endif /* NODE_H_ */
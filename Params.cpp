@@ -5,11 +5,24 @@
  **********************************/
 
 #include "Params.h"
+#include "Node.h"
 
 /**
  * Constructor
  */
-Params::Params(): PORTNUM(8001) {}
+Params::Params(): SINGLE_FAILURE(0), MSG_DROP_PROB(0), DROP_MSG(0), PORTNUM(8001),
+	TRANSPORT(EMULATED_TRANSPORT), UDP_BASE_PORT(20000), COALESCE(0), SEED(time(NULL)), TRAFFIC_CSV(0), THREADS(1), VNODES(1), ANTI_ENTROPY(0),
+	READ_REPAIR(NO_READ_REPAIR), READ_REPAIR_CHANCE(0.1), STORAGE(FLAT_STORAGE),
+	WAL(WAL_OFF), WAL_INTERVAL(10), WAL_DIR("wal"), WAL_RESET(0), SNAPSHOT(0),
+	INSERTS(100), VALUE_SIZE(0) {
+	QUORUM.n = 3;
+	QUORUM.r = 2;
+	QUORUM.w = 2;
+	LINK_MODEL.type = NO_LATENCY;
+	LINK_MODEL.a = 0;
+	LINK_MODEL.b = 0;
+	LINK_MODEL.bandwidth = 0;
+}
 
 /**
  * FUNCTION NAME: setparams
@@ -19,6 +32,7 @@ Params::Params(): PORTNUM(8001) {}
 void Params::setparams(char *config_file) {
 	//trace.funcEntry("Params::setparams");
 	char CRUD[10];
+	char name[64], value[64];
 	FILE *fp = fopen(config_file,"r");
 
 	fscanf(fp,"MAX_NNB: %d", &MAX_NNB);
@@ -51,11 +65,264 @@ void Params::setparams(char *config_file) {
 	for ( unsigned int i = 0; i < EN_GPSZ; i++ ) {
 		allNodesJoined += i;
 	}
+
+	// Optional settings, one "NAME: value" per line after CRUD_TEST
+	while ( fscanf(fp, " %63[^:]: %63s", name, value) == 2 ) {
+		setoption(name, value);
+	}
 	fclose(fp);
 	//trace.funcExit("Params::setparams", SUCCESS);
 	return;
 }
 
+/**
+ * FUNCTION NAME: setoption
+ *
+ * DESCRIPTION: Apply one optional setting from the config file. Unknown names are ignored.
+ */
+void Params::setoption(char *name, char *value) {
+	if ( 0 == strcmp(name, "TRANSPORT") ) {
+		if ( 0 == strcmp(value, "UDP") ) {
+			TRANSPORT = UDP_TRANSPORT;
+		}
+		else {
+			TRANSPORT = EMULATED_TRANSPORT;
+		}
+	}
+	else if ( 0 == strcmp(name, "UDP_BASE_PORT") ) {
+		UDP_BASE_PORT = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "LATENCY") ) {
+		parseLinkModel(value, &LINK_MODEL);
+	}
+	else if ( 0 == strcmp(name, "BANDWIDTH") ) {
+		LINK_MODEL.bandwidth = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "COALESCE") ) {
+		COALESCE = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "SEED") ) {
+		SEED = strtoull(value, NULL, 10);
+	}
+	else if ( 0 == strcmp(name, "TRAFFIC_CSV") ) {
+		TRAFFIC_CSV = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "THREADS") ) {
+		THREADS = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "VNODES") ) {
+		VNODES = atoi(value);
+		if ( VNODES < 1 ) {
+			VNODES = 1;
+		}
+	}
+	else if ( 0 == strcmp(name, "ANTI_ENTROPY") ) {
+		ANTI_ENTROPY = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "READ_REPAIR") ) {
+		// READ_REPAIR: <NONE|BLOCKING|BACKGROUND|PROBABILISTIC>[,chance]
+		char mode[16];
+		double chance = READ_REPAIR_CHANCE;
+		if ( sscanf(value, "%15[^,],%lf", mode, &chance) >= 1 ) {
+			if ( 0 == strcmp(mode, "BLOCKING") ) {
+				READ_REPAIR = BLOCKING_READ_REPAIR;
+			}
+			else if ( 0 == strcmp(mode, "BACKGROUND") ) {
+				READ_REPAIR = BACKGROUND_READ_REPAIR;
+			}
+			else if ( 0 == strcmp(mode, "PROBABILISTIC") ) {
+				READ_REPAIR = PROBABILISTIC_READ_REPAIR;
+			}
+			else {
+				READ_REPAIR = NO_READ_REPAIR;
+			}
+			READ_REPAIR_CHANCE = chance;
+		}
+	}
+	else if ( 0 == strcmp(name, "STORAGE") ) {
+		// STORAGE: <FLAT|MAP>
+		STORAGE = 0 == strcmp(value, "MAP") ? MAP_STORAGE : FLAT_STORAGE;
+	}
+	else if ( 0 == strcmp(name, "WAL") ) {
+		// WAL: <OFF|NONE|ALWAYS|INTERVAL>[,ticks], NONE logs without syncing
+		char mode[16];
+		int ticks = WAL_INTERVAL;
+		if ( sscanf(value, "%15[^,],%d", mode, &ticks) >= 1 ) {
+			if ( 0 == strcmp(mode, "NONE") ) {
+				WAL = WAL_NO_SYNC;
+			}
+			else if ( 0 == strcmp(mode, "ALWAYS") ) {
+				WAL = WAL_SYNC_ALWAYS;
+			}
+			else if ( 0 == strcmp(mode, "INTERVAL") ) {
+				WAL = WAL_SYNC_INTERVAL;
+			}
+			else {
+				WAL = WAL_OFF;
+			}
+			WAL_INTERVAL = max(ticks, 1);
+		}
+	}
+	else if ( 0 == strcmp(name, "WAL_DIR") ) {
+		WAL_DIR = value;
+	}
+	else if ( 0 == strcmp(name, "WAL_RESET") ) {
+		WAL_RESET = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "SNAPSHOT") ) {
+		SNAPSHOT = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "QUORUM") ) {
+		// QUORUM: <N>,<R>,<W>
+		parseQuorum(value, &QUORUM);
+	}
+	else if ( 0 == strcmp(name, "NAMESPACE") ) {
+		// NAMESPACE: <key prefix>=<N>,<R>,<W>, starting from the current QUORUM
+		namespace_quorum nq;
+		char *eq = strchr(value, '=');
+		nq.level = QUORUM;
+		if ( eq != NULL && parseQuorum(eq + 1, &nq.level) ) {
+			nq.prefix = string(value, eq - value);
+			NAMESPACES.push_back(nq);
+		}
+	}
+	else if ( 0 == strcmp(name, "INSERTS") ) {
+		INSERTS = max(atoi(value), 1);
+	}
+	else if ( 0 == strcmp(name, "VALUE_SIZE") ) {
+		VALUE_SIZE = atoi(value);
+	}
+	else if ( 0 == strcmp(name, "ISOLATE") ) {
+		// ISOLATE: <node>,<from tick>,<to tick>[,IN|OUT], both directions by default
+		isolation iso;
+		char direction[4] = "";
+		if ( sscanf(value, "%d,%d,%d,%3s", &iso.node, &iso.from, &iso.to, direction) >= 3 ) {
+			iso.in = 0 != strcmp(direction, "OUT");
+			iso.out = 0 != strcmp(direction, "IN");
+			ISOLATIONS.push_back(iso);
+		}
+	}
+	else if ( 0 == strcmp(name, "LINK") ) {
+		// LINK: <src>><dst>,<model spec>, starting from the current LINK_MODEL
+		link_override lo;
+		int used = 0;
+		lo.model = LINK_MODEL;
+		if ( sscanf(value, "%d>%d,%n", &lo.src, &lo.dst, &used) == 2 && used > 0
+				&& parseLinkModel(value + used, &lo.model) ) {
+			LINK_OVERRIDES.push_back(lo);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: parseQuorum
+ *
+ * DESCRIPTION: Parse "<N>,<R>,<W>" into level. N is kept within [1, MAX_REPLICAS] and
+ * 				R and W within [1, N].
+ *
+ * RETURNS:
+ * true if all three numbers were given
+ */
+bool Params::parseQuorum(char *spec, quorum_level *level) {
+	int n, r, w;
+
+	if ( sscanf(spec, "%d,%d,%d", &n, &r, &w) != 3 ) {
+		return false;
+	}
+	level->n = min(max(n, 1), MAX_REPLICAS);
+	level->r = min(max(r, 1), level->n);
+	level->w = min(max(w, 1), level->n);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: quorumFor
+ *
+ * DESCRIPTION: Quorum level of a key, from the longest NAMESPACES prefix it starts with,
+ * 				or QUORUM if it starts with none
+ */
+const quorum_level &Params::quorumFor(string_view key) {
+	const quorum_level *level = &QUORUM;
+	size_t longest = 0;
+
+	for ( auto &nq : NAMESPACES ) {
+		if ( nq.prefix.size() >= longest && key.substr(0, nq.prefix.size()) == nq.prefix ) {
+			level = &nq.level;
+			longest = nq.prefix.size();
+		}
+	}
+	return *level;
+}
+
+/**
+ * FUNCTION NAME: isolated
+ *
+ * DESCRIPTION: Whether ISOLATIONS drop a message from node src to node dst at the current tick
+ */
+bool Params::isolated(int src, int dst) {
+	for ( auto &iso : ISOLATIONS ) {
+		if ( globaltime >= iso.from && globaltime <= iso.to
+				&& ((iso.out && iso.node == src) || (iso.in && iso.node == dst)) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * FUNCTION NAME: replicaCounts
+ *
+ * DESCRIPTION: Distinct N of QUORUM and NAMESPACES, in increasing order
+ */
+vector<int> Params::replicaCounts() {
+	vector<int> counts(1, QUORUM.n);
+
+	for ( auto &nq : NAMESPACES ) {
+		counts.push_back(nq.level.n);
+	}
+	sort(counts.begin(), counts.end());
+	counts.erase(unique(counts.begin(), counts.end()), counts.end());
+	return counts;
+}
+
+/**
+ * FUNCTION NAME: parseLinkModel
+ *
+ * DESCRIPTION: Parse "<NONE|FIXED|UNIFORM|LOGNORMAL>[,a[,b[,bandwidth]]]" into model.
+ * 				Fields that are left out keep their current value.
+ *
+ * RETURNS:
+ * true if the model name was recognised
+ */
+bool Params::parseLinkModel(char *spec, link_model *model) {
+	char type[16];
+	double a = model->a, b = model->b;
+	int bandwidth = model->bandwidth;
+
+	if ( sscanf(spec, "%15[^,],%lf,%lf,%d", type, &a, &b, &bandwidth) < 1 ) {
+		return false;
+	}
+	if ( 0 == strcmp(type, "NONE") ) {
+		model->type = NO_LATENCY;
+	}
+	else if ( 0 == strcmp(type, "FIXED") ) {
+		model->type = FIXED_LATENCY;
+	}
+	else if ( 0 == strcmp(type, "UNIFORM") ) {
+		model->type = UNIFORM_LATENCY;
+	}
+	else if ( 0 == strcmp(type, "LOGNORMAL") ) {
+		model->type = LOGNORMAL_LATENCY;
+	}
+	else {
+		return false;
+	}
+	model->a = a;
+	model->b = b;
+	model->bandwidth = bandwidth;
+	return true;
+}
+
 /**
  * FUNCTION NAME: getcurrtime
  *
@@ -12,6 +12,72 @@
 #include "Member.h"
 
 enum testTYPE { CREATE_TEST, READ_TEST, UPDATE_TEST, DELETE_TEST };
+enum transportTYPE { EMULATED_TRANSPORT, UDP_TRANSPORT };
+enum latencyTYPE { NO_LATENCY, FIXED_LATENCY, UNIFORM_LATENCY, LOGNORMAL_LATENCY };
+enum storageTYPE { FLAT_STORAGE, MAP_STORAGE };
+enum readRepairTYPE { NO_READ_REPAIR, BLOCKING_READ_REPAIR, BACKGROUND_READ_REPAIR, PROBABILISTIC_READ_REPAIR };
+enum walTYPE { WAL_OFF, WAL_NO_SYNC, WAL_SYNC_ALWAYS, WAL_SYNC_INTERVAL };
+
+/**
+ * Struct Name: link_model
+ *
+ * DESCRIPTION: Delay of one direction of a link, in ticks. FIXED waits a, UNIFORM draws
+ * 				from [a, b], LOGNORMAL has median a and shape b. bandwidth is in bytes
+ * 				per tick, 0 means unlimited.
+ */
+typedef struct link_model {
+	int type;
+	double a;
+	double b;
+	int bandwidth;
+}link_model;
+
+/**
+ * Struct Name: link_override
+ *
+ * DESCRIPTION: Model of the link from node src to node dst
+ */
+typedef struct link_override {
+	int src;
+	int dst;
+	link_model model;
+}link_override;
+
+/**
+ * Struct Name: isolation
+ *
+ * DESCRIPTION: Node cut off from the network from tick from to tick to. The messages sent
+ * 				to it (in) and the messages it sends (out) in that time are dropped.
+ */
+typedef struct isolation {
+	int node;
+	int from;
+	int to;
+	bool in;
+	bool out;
+}isolation;
+
+/**
+ * Struct Name: quorum_level
+ *
+ * DESCRIPTION: Replicas a key is stored on (n), and how many of them must return the same
+ * 				value to a read (r) or acknowledge a write (w) for the client operation to succeed
+ */
+typedef struct quorum_level {
+	int n;
+	int r;
+	int w;
+}quorum_level;
+
+/**
+ * Struct Name: namespace_quorum
+ *
+ * DESCRIPTION: Quorum level of the keys starting with prefix
+ */
+typedef struct namespace_quorum {
+	string prefix;
+	quorum_level level;
+}namespace_quorum;
 
 /**
  * CLASS NAME: Params
@@ -32,8 +98,37 @@ public:
 	int allNodesJoined;
 	short PORTNUM;
 	int CRUDTEST;
+	int TRANSPORT;				// emulated in-memory network or loopback UDP
+	int UDP_BASE_PORT;			// first local port used by the UDP transport
+	link_model LINK_MODEL;		// latency and bandwidth of every link
+	vector<link_override> LINK_OVERRIDES;	// links that differ from LINK_MODEL
+	int COALESCE;				// batch one tick's messages per (src, dst) into one frame
+	unsigned long long SEED;	// seeds every generator, from the clock unless configured; repeats need the same THREADS
+	int TRAFFIC_CSV;			// also write the traffic accounting to msgcount.csv
+	int THREADS;				// worker threads per tick, 1 runs the nodes serially, 0 uses every core
+	int VNODES;					// positions each member takes on the key-value ring
+	int ANTI_ENTROPY;			// ticks between Merkle tree comparisons of replicas, 0 disables them
+	int READ_REPAIR;			// when reads fix the replicas that returned stale data or nothing
+	double READ_REPAIR_CHANCE;	// fraction of reads checked by PROBABILISTIC read repair
+	int STORAGE;				// storage engine of the KV nodes
+	int WAL;					// write-ahead log of the KV nodes and when it is synced to disk
+	int WAL_INTERVAL;			// ticks between syncs of WAL_SYNC_INTERVAL
+	string WAL_DIR;				// directory of the write-ahead logs, one file per node
+	int WAL_RESET;				// start from empty logs and snapshots instead of recovering an earlier run
+	int SNAPSHOT;				// ticks between snapshots that truncate the write-ahead logs, 0 disables them
+	quorum_level QUORUM;		// replicas of a key and the replies its reads and writes wait for
+	vector<namespace_quorum> NAMESPACES;	// key prefixes with their own quorum level
+	int INSERTS;				// test key value pairs the CRUD tests insert
+	int VALUE_SIZE;				// least length of the test values, padded to it
+	vector<isolation> ISOLATIONS;	// nodes cut off from the network for a while
 	Params();
 	void setparams(char *);
+	void setoption(char *name, char *value);
+	bool parseLinkModel(char *spec, link_model *model);
+	bool parseQuorum(char *spec, quorum_level *level);
+	const quorum_level &quorumFor(string_view key);
+	bool isolated(int src, int dst);
+	vector<int> replicaCounts();
 	int getcurrtime();
 };
 
@@ -0,0 +1,234 @@
+/**********************************
+ * FILE NAME: PendingTable.cpp
+ *
+ * DESCRIPTION: Table of client requests waiting for replies, definition
+ **********************************/
+
+#include "PendingTable.h"
+
+/**
+ * Constructor
+ */
+PendingTable::PendingTable() {
+	slots.assign(PENDING_INITIAL_CAPACITY, NULL);
+	used = 0;
+	freeList = NULL;
+	for ( int i = 0; i < PENDING_WHEEL_SLOTS; i++ ) {
+		wheel[i] = NULL;
+		wheelTail[i] = NULL;
+	}
+	expiredUpTo = 0;
+}
+
+/**
+ * Destructor
+ */
+PendingTable::~PendingTable() {
+	for ( size_t i = 0; i < slabs.size(); i++ ) {
+		delete [] slabs[i];
+	}
+}
+
+/**
+ * FUNCTION NAME: grow
+ *
+ * DESCRIPTION: Double the hash slots and reinsert every request
+ */
+void PendingTable::grow() {
+	vector<wait_element*> old;
+	old.swap(slots);
+	slots.assign(old.size() * 2, NULL);
+	for ( size_t i = 0; i < old.size(); i++ ) {
+		if ( old[i] ) {
+			insert(old[i]);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: insert
+ *
+ * DESCRIPTION: Put we in the first free slot at or after its home slot
+ */
+void PendingTable::insert(wait_element *we) {
+	size_t mask = slots.size() - 1;
+	size_t i = slotOf(we->transID);
+	while ( slots[i] ) {
+		i = (i + 1) & mask;
+	}
+	slots[i] = we;
+}
+
+/**
+ * FUNCTION NAME: erase
+ *
+ * DESCRIPTION: Remove we from the hash slots. Later members of its probe run are
+ * 				shifted back, so lookups never need tombstones.
+ */
+void PendingTable::erase(wait_element *we) {
+	size_t mask = slots.size() - 1;
+	size_t i = slotOf(we->transID);
+	while ( slots[i] != we ) {
+		i = (i + 1) & mask;
+	}
+	size_t j = i;
+	while ( true ) {
+		j = (j + 1) & mask;
+		if ( slots[j] == NULL ) {
+			break;
+		}
+		size_t home = slotOf(slots[j]->transID);
+		// slots[j] may fill the hole at i only if its home is not in (i, j]
+		if ( ((j - home) & mask) >= ((j - i) & mask) ) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i] = NULL;
+}
+
+/**
+ * FUNCTION NAME: linkTimer
+ *
+ * DESCRIPTION: Put we at the end of the wheel slot of tick expireAt
+ */
+void PendingTable::linkTimer(wait_element *we, long long int expireAt) {
+	int s = expireAt & (PENDING_WHEEL_SLOTS - 1);
+	we->expire_at = expireAt;
+	we->timer_next = NULL;
+	we->timer_prev = wheelTail[s];
+	if ( wheelTail[s] ) {
+		wheelTail[s]->timer_next = we;
+	}
+	else {
+		wheel[s] = we;
+	}
+	wheelTail[s] = we;
+}
+
+/**
+ * FUNCTION NAME: unlinkTimer
+ *
+ * DESCRIPTION: Take we out of its wheel slot
+ */
+void PendingTable::unlinkTimer(wait_element *we) {
+	int s = we->expire_at & (PENDING_WHEEL_SLOTS - 1);
+	if ( we->timer_prev ) {
+		we->timer_prev->timer_next = we->timer_next;
+	}
+	else {
+		wheel[s] = we->timer_next;
+	}
+	if ( we->timer_next ) {
+		we->timer_next->timer_prev = we->timer_prev;
+	}
+	else {
+		wheelTail[s] = we->timer_prev;
+	}
+}
+
+/**
+ * FUNCTION NAME: create
+ *
+ * DESCRIPTION: Register a new request that times out at tick expireAt.
+ * 				The caller fills in the request fields.
+ *
+ * RETURNS:
+ * the new element
+ */
+wait_element *PendingTable::create(int transID, long long int expireAt) {
+	if ( freeList == NULL ) {
+		wait_element *slab = new wait_element[PENDING_SLAB_SIZE];
+		slabs.push_back(slab);
+		for ( int i = 0; i < PENDING_SLAB_SIZE; i++ ) {
+			slab[i].timer_next = freeList;
+			freeList = &slab[i];
+		}
+	}
+	wait_element *we = freeList;
+	freeList = we->timer_next;
+
+	we->transID = transID;
+	we->successes = 0;
+	we->failures = 0;
+	we->key.clear();
+	we->value.clear();
+	we->values.clear();
+
+	// Keep the load factor at or below one half
+	if ( 2 * (used + 1) > (int)slots.size() ) {
+		grow();
+	}
+	insert(we);
+	used++;
+
+	// Appending keeps each slot in creation order, which is the order requests expire in
+	linkTimer(we, expireAt);
+	return we;
+}
+
+/**
+ * FUNCTION NAME: find
+ *
+ * RETURNS:
+ * the request with this transID, or NULL
+ */
+wait_element *PendingTable::find(int transID) {
+	size_t mask = slots.size() - 1;
+	size_t i = slotOf(transID);
+	while ( slots[i] ) {
+		if ( slots[i]->transID == transID ) {
+			return slots[i];
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+/**
+ * FUNCTION NAME: remove
+ *
+ * DESCRIPTION: Forget a completed or expired request and recycle its element
+ */
+void PendingTable::remove(wait_element *we) {
+	erase(we);
+	unlinkTimer(we);
+	used--;
+	we->timer_next = freeList;
+	freeList = we;
+}
+
+/**
+ * FUNCTION NAME: extend
+ *
+ * DESCRIPTION: Move the timeout of a request to the later tick expireAt
+ */
+void PendingTable::extend(wait_element *we, long long int expireAt) {
+	unlinkTimer(we);
+	linkTimer(we, expireAt);
+}
+
+/**
+ * FUNCTION NAME: nextExpired
+ *
+ * DESCRIPTION: Oldest request whose timeout is at or before now, in creation order.
+ * 				It stays in the table until the caller removes it.
+ *
+ * RETURNS:
+ * the request, or NULL when nothing more has expired
+ */
+wait_element *PendingTable::nextExpired(long long int now) {
+	while ( expiredUpTo <= now ) {
+		for ( wait_element *we = wheel[expiredUpTo & (PENDING_WHEEL_SLOTS - 1)]; we; we = we->timer_next ) {
+			if ( we->expire_at <= now ) {
+				return we;
+			}
+		}
+		if ( used == 0 ) {
+			expiredUpTo = now + 1;
+			break;
+		}
+		expiredUpTo++;
+	}
+	return NULL;
+}
@@ -0,0 +1,83 @@
+/**********************************
+ * FILE NAME: PendingTable.h
+ *
+ * DESCRIPTION: Table of client requests waiting for replies, header file
+ **********************************/
+
+#ifndef PENDINGTABLE_H_
+#define PENDINGTABLE_H_
+
+#include "stdincludes.h"
+#include "common.h"
+
+// wait_elements allocated per slab
+#define PENDING_SLAB_SIZE 64
+// Slots of the expiry wheel, a power of two larger than any timeout
+#define PENDING_WHEEL_SLOTS 64
+// Initial number of hash slots, a power of two
+#define PENDING_INITIAL_CAPACITY 64
+
+struct wait_element{
+	enum MessageType msgType;
+	int transID;
+	string key;
+	string value;
+	// Replicas asked, and the successful replies the request needs: R for a READ, W otherwise
+	int replicas;
+	int needed;
+	int successes;
+	int failures;
+	// Value of each successful READREPLY
+	vector<string> values;
+	long long int cur_time;
+	// Tick at which the request times out, and its links in that wheel slot
+	long long int expire_at;
+	wait_element *timer_prev;
+	wait_element *timer_next;
+};
+
+/**
+ * CLASS NAME: PendingTable
+ *
+ * DESCRIPTION: Requests of a coordinator indexed by transID. Lookup is an open
+ * 				addressing table with linear probing, elements come from slabs that
+ * 				are never returned to the heap, and timeouts sit in a wheel slot per
+ * 				tick, so creating, completing and expiring a request are all O(1).
+ */
+class PendingTable {
+private:
+	// Hash slots, NULL when empty
+	vector<wait_element*> slots;
+	int used;
+	vector<wait_element*> slabs;
+	// Free elements, linked through timer_next
+	wait_element *freeList;
+	// Doubly linked lists of requests by expire_at % PENDING_WHEEL_SLOTS
+	wait_element *wheel[PENDING_WHEEL_SLOTS];
+	wait_element *wheelTail[PENDING_WHEEL_SLOTS];
+	// Every tick before this one has been expired
+	long long int expiredUpTo;
+	size_t slotOf(int transID) {
+		return ((unsigned int)transID * 2654435769u) & (slots.size() - 1);
+	}
+	void grow();
+	void insert(wait_element *we);
+	void erase(wait_element *we);
+	void linkTimer(wait_element *we, long long int expireAt);
+	void unlinkTimer(wait_element *we);
+public:
+	PendingTable();
+	PendingTable(const PendingTable &anotherTable) = delete;
+	PendingTable& operator = (const PendingTable &anotherTable) = delete;
+	virtual ~PendingTable();
+	wait_element *create(int transID, long long int expireAt);
+	wait_element *find(int transID);
+	void remove(wait_element *we);
+	void extend(wait_element *we, long long int expireAt);
+	wait_element *nextExpired(long long int now);
+	int size() {
+		return used;
+	}
+};
+
+#endif /* PENDINGTABLE_H_ */
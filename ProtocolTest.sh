@@ -0,0 +1,112 @@
+#!/bin/bash
+
+#################################################
+# FILE NAME: ProtocolTest.sh
+#
+# DESCRIPTION: End to end checks of the KV store protocols. Every
+#              testcase runs the Application on a config from
+#              testcases/ and checks dbg.log and stats.log.
+#
+# RUN PROCEDURE:
+# $ make test
+#################################################
+
+FAILED=0
+
+# Run the Application on testcases/<name>.conf
+function run () {
+	./Application ./testcases/$1.conf > test.out 2>&1
+	if [ $? -ne 0 ]
+	then
+		echo "$1: Application failed"
+		FAILED=1
+	fi
+}
+
+# Report whether a check holds: expect <description> <command...>
+function expect () {
+	local description="$1"
+	shift
+	if "$@"
+	then
+		echo "PASS: ${description}"
+	else
+		echo "FAIL: ${description}"
+		FAILED=1
+	fi
+}
+
+# count <pattern> <file>: number of lines of file matching the extended regex
+function count () {
+	grep -E -c "$1" "$2"
+}
+
+# at_least <n> <pattern> <file>
+function at_least () {
+	[ "$(count "$2" "$3")" -ge "$1" ]
+}
+
+# none <pattern> <file>
+function none () {
+	[ "$(count "$1" "$2")" -eq 0 ]
+}
+
+# A key with fewer live copies than its N at the end of the run fails any testcase
+function fully_replicated () {
+	at_least 1 "#STATSLOG# replicas keys=[1-9][0-9]* under=0 " stats.log
+}
+
+# The membership and KV traffic of every node go through its own loopback UDP sockets
+echo "UDP: the KV store works over real sockets"
+run udp
+expect "every socket opened and every send went out" none "UdpNet" test.out
+expect "every create reached its quorum" at_least 100 "coordinator: create success" dbg.log
+expect "every replica stored its creates" at_least 300 "server: create success" dbg.log
+expect "every key has all its replicas" fully_replicated
+
+# Eight 494 byte entries make 3952 bytes, more than a message carries next to the
+# BULK and en_msg headers, so chunks filled past that limit are never delivered
+echo "BULK: keys of failed replicas stream to new ones in several chunks"
+run bulk
+expect "a transfer took more than one chunk" at_least 1 "Bulk transfer .* done: [0-9]+ keys in ([2-9]|[1-9][0-9]+) chunks" dbg.log
+expect "every chunk fit in a message" none "Cannot send|do not fit in a chunk" dbg.log
+expect "every key has all its replicas" fully_replicated
+
+echo "BULK: values too large for a chunk are refused"
+run oversize
+expect "every create was refused" at_least 5 "Refuse key .* does not fit in a chunk" dbg.log
+expect "the coordinator logged the failures" at_least 5 "coordinator: create fail" dbg.log
+expect "nothing was stored" none "server: create success" dbg.log
+
+# Node 5 misses the creates of tick 100 without being suspected, so only anti-entropy
+# restores its copies. Two 1973 byte entries and their BULK header make 3951 bytes,
+# more than a SYNC message carries, so a leaf of two keys takes two chunks.
+echo "SYNC: anti-entropy repairs a replica that missed writes"
+run sync
+expect "a leaf was repaired from more than one chunk" at_least 1 "Anti-entropy repaired [0-9]+ copies .* took ([2-9]|[1-9][0-9]+) chunks" dbg.log
+expect "every chunk fit in a message" none "Cannot send|does not fit in a chunk" dbg.log
+expect "every key has all its replicas" fully_replicated
+
+# Node 5 sends nothing from tick 89 to 102, so the coordinators of tick 100 suspect it
+# and keep hints, and no reply of it clears one. It also misses those creates, so only
+# the replayed hints give it its copies. A chunk carries seven of these hints.
+echo "Hints: writes a suspected replica missed are replayed once it is back"
+run hints
+expect "a hint transfer took more than one chunk" at_least 1 "Hint transfer .* done: [0-9]+ keys in ([2-9]|[1-9][0-9]+) chunks" dbg.log
+expect "no hint transfer was abandoned" none "Hint transfer .* abandoned" dbg.log
+expect "every key has all its replicas" fully_replicated
+
+# Node 7, a replica of the key the READ test reads, hears nothing at tick 100 and misses
+# the creates. It keeps sending, so it is not suspected and gets no hints.
+echo "Read repair: a read writes the value it returns to a replica that missed it"
+run readrepair
+expect "node 7 is a replica of the key read" at_least 1 "\[150\] Choose 7:0 for read" dbg.log
+expect "the read repaired node 7" at_least 1 "Read repair of key .* to 7:0" dbg.log
+expect "node 7 returns the value to the next read" at_least 1 "^ 7.0.0.0:0 \[17[5-9]\] server: read success" dbg.log
+
+if [ ${FAILED} -ne 0 ]
+then
+	echo "Protocol tests FAILED"
+	exit 1
+fi
+echo "All protocol tests passed"
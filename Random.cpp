@@ -0,0 +1,48 @@
+/**********************************
+ * FILE NAME: Random.cpp
+ *
+ * DESCRIPTION: Seeded pseudo random number generator definition
+ **********************************/
+
+#include "Random.h"
+
+/**
+ * Constructor, a fixed default stream until seed() is called
+ */
+Random::Random() {
+	seed(0, 0, 0);
+}
+
+/**
+ * Overloaded Constructor
+ */
+Random::Random(uint64_t seed, int stream, uint64_t id) {
+	this->seed(seed, stream, id);
+}
+
+/**
+ * FUNCTION NAME: splitmix64
+ *
+ * DESCRIPTION: Advance state and return the next splitmix64 output
+ */
+uint64_t Random::splitmix64(uint64_t &state) {
+	uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/**
+ * FUNCTION NAME: seed
+ *
+ * DESCRIPTION: Derive the state from the run seed, the stream and the id within the stream.
+ * 				splitmix64 spreads nearby seeds and ids apart.
+ */
+void Random::seed(uint64_t seed, int stream, uint64_t id) {
+	uint64_t state = seed;
+	state = splitmix64(state) ^ (uint64_t)stream;
+	state = splitmix64(state) ^ id;
+	for ( int i = 0; i < 4; i++ ) {
+		s[i] = splitmix64(state);
+	}
+}
@@ -0,0 +1,57 @@
+/**********************************
+ * FILE NAME: Random.h
+ *
+ * DESCRIPTION: Seeded pseudo random number generator header file
+ **********************************/
+
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include "stdincludes.h"
+#include <stdint.h>
+
+/**
+ * Independent streams derived from the one run seed
+ */
+enum rngStream { RNG_APPLICATION = 1, RNG_MEMBERSHIP, RNG_KVSTORE, RNG_NETWORK };
+
+/**
+ * CLASS NAME: Random
+ *
+ * DESCRIPTION: xoshiro256** generator. Every node and subsystem owns one, seeded from
+ * 				(run seed, stream, id), so a run is reproduced by its seed together with
+ * 				its THREADS value, and no generator is shared between threads.
+ */
+class Random {
+private:
+	uint64_t s[4];
+	static uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+public:
+	Random();
+	Random(uint64_t seed, int stream, uint64_t id);
+	void seed(uint64_t seed, int stream, uint64_t id);
+	static uint64_t splitmix64(uint64_t &state);
+	uint64_t next() {
+		uint64_t result = rotl(s[1] * 5, 7) * 9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+	// Uniform in [0, n), n > 0
+	unsigned int below(unsigned int n) {
+		return (unsigned int)(((next() >> 32) * n) >> 32);
+	}
+	// Uniform in [0, 1)
+	double uniform() {
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+};
+
+#endif /* _RANDOM_H_ */
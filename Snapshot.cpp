@@ -0,0 +1,386 @@
+/**********************************
+ * FILE NAME: Snapshot.cpp
+ *
+ * DESCRIPTION: Definition of SnapshotFile
+ **********************************/
+
+#include "Snapshot.h"
+#include "Crc.h"
+#include "Message.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes gathered before each write() of a snapshot being written
+#define SNAPSHOT_WRITE_BUFFER (1 << 20)
+
+static inline void putU32(unsigned char *p, uint32_t v) {
+	for ( int i = 0; i < 4; i++ ) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static inline void putU64(unsigned char *p, uint64_t v) {
+	for ( int i = 0; i < 8; i++ ) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static inline uint32_t getU32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t getU64(const unsigned char *p) {
+	return (uint64_t)getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+}
+
+/**
+ * Struct Name: snapshot_writer
+ *
+ * DESCRIPTION: Buffered output of a snapshot body that keeps the checksum of each
+ * 				SNAPSHOT_CHUNK bytes as they pass
+ */
+typedef struct snapshot_writer {
+	int fd;
+	string buffer;
+	// bytes of body put so far
+	uint64_t pos;
+	uint32_t crc;
+	vector<uint32_t> crcs;
+	bool failed;
+
+	void put(const void *data, size_t size) {
+		const char *p = (const char *)data;
+		while ( size > 0 ) {
+			size_t room = SNAPSHOT_CHUNK - pos % SNAPSHOT_CHUNK;
+			size_t n = min(size, room);
+			crc = crc32c(p, n, crc);
+			buffer.append(p, n);
+			pos += n;
+			if ( n == room ) {
+				crcs.push_back(crc);
+				crc = 0;
+			}
+			p += n;
+			size -= n;
+		}
+		if ( buffer.size() >= SNAPSHOT_WRITE_BUFFER ) {
+			flush();
+		}
+	}
+
+	// checksum of the last, partial chunk
+	void finish() {
+		if ( pos % SNAPSHOT_CHUNK != 0 ) {
+			crcs.push_back(crc);
+		}
+	}
+
+	void flush() {
+		const char *p = buffer.data();
+		size_t size = buffer.size();
+		while ( size > 0 && !failed ) {
+			ssize_t n = ::write(fd, p, size);
+			if ( n < 0 && errno == EINTR ) {
+				continue;
+			}
+			if ( n < 0 ) {
+				failed = true;
+				break;
+			}
+			p += n;
+			size -= n;
+		}
+		buffer.clear();
+	}
+}snapshot_writer;
+
+/**
+ * Constructor
+ */
+SnapshotFile::SnapshotFile(): base(NULL), mapped(0), count(0), dataSize(0), indexOffset(0), bodyEnd(0), chunks(0),
+		corrupt(false) {}
+
+/**
+ * Destructor
+ */
+SnapshotFile::~SnapshotFile() {
+	close();
+}
+
+/**
+ * FUNCTION NAME: write
+ *
+ * DESCRIPTION: Write every pair of engine to a snapshot at path. The file is written under
+ * 				a temporary name, synced and then renamed over path, so a crash leaves either
+ * 				the old snapshot or the new one. The pairs are sorted through pointers into
+ * 				the engine rather than copied, engine must not change until this returns.
+ * 				sequence is the last write-ahead log record engine holds. bytes is set to
+ * 				the size of the file.
+ *
+ * RETURNS:
+ * true if the snapshot is on disk
+ */
+bool SnapshotFile::write(const string &path, StorageEngine *engine, uint64_t sequence, size_t *bytes) {
+	vector<pair<const string *, const string *>> pairs;
+	pairs.reserve(engine->currentSize());
+	engine->forEach([&](const string &key, const string &value) {
+		pairs.emplace_back(&key, &value);
+	});
+	sort(pairs.begin(), pairs.end(), [](const auto &a, const auto &b) {
+		return *a.first < *b.first;
+	});
+
+	string tmp = path + ".tmp";
+	snapshot_writer out;
+	out.fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ( out.fd < 0 ) {
+		perror(("SnapshotFile open " + tmp).c_str());
+		return false;
+	}
+	out.pos = 0;
+	out.crc = 0;
+	out.failed = false;
+	// The header is filled in once the sizes are known
+	unsigned char header[SNAPSHOT_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	out.buffer.append((const char *)header, sizeof(header));
+
+	// data block
+	vector<uint64_t> offsets;
+	offsets.reserve(pairs.size());
+	char varints[2 * MESSAGE_MAX_VARINT];
+	for ( auto &p : pairs ) {
+		offsets.push_back(out.pos);
+		int n = putVarint(varints, (unsigned int)p.first->size());
+		n += putVarint(varints + n, (unsigned int)p.second->size());
+		out.put(varints, n);
+		out.put(p.first->data(), p.first->size());
+		out.put(p.second->data(), p.second->size());
+	}
+	uint64_t dataSize = out.pos;
+
+	// index block, 8 byte aligned
+	static const char padding[8] = {0};
+	out.put(padding, (8 - out.pos % 8) % 8);
+	uint64_t indexOffset = SNAPSHOT_HEADER_SIZE + out.pos;
+	for ( uint64_t off : offsets ) {
+		unsigned char b[8];
+		putU64(b, off);
+		out.put(b, 8);
+	}
+	out.finish();
+	uint64_t bodyEnd = SNAPSHOT_HEADER_SIZE + out.pos;
+
+	// checksum table, outside the chunks
+	string table(4 * out.crcs.size(), '\0');
+	for ( size_t i = 0; i < out.crcs.size(); i++ ) {
+		putU32((unsigned char *)&table[4 * i], out.crcs[i]);
+	}
+	out.buffer.append(table);
+	out.flush();
+
+	memcpy(header, SNAPSHOT_MAGIC, 8);
+	putU64(header + 8, pairs.size());
+	putU64(header + 16, dataSize);
+	putU64(header + 24, indexOffset);
+	putU64(header + 32, bodyEnd);
+	putU32(header + 40, (uint32_t)out.crcs.size());
+	putU32(header + 44, crc32c(table.data(), table.size()));
+	putU64(header + 48, sequence);
+	putU32(header + 56, crc32c(header, 56));
+	bool ok = !out.failed && pwrite(out.fd, header, sizeof(header), 0) == (ssize_t)sizeof(header)
+			&& fdatasync(out.fd) == 0;
+	if ( !ok ) {
+		perror(("SnapshotFile write " + tmp).c_str());
+	}
+	::close(out.fd);
+	if ( ok && rename(tmp.c_str(), path.c_str()) < 0 ) {
+		perror(("SnapshotFile rename " + tmp).c_str());
+		ok = false;
+	}
+	if ( !ok ) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	// Sync the directory so the rename itself survives a crash
+	size_t slash = path.rfind('/');
+	int dir = ::open(slash == string::npos ? "." : path.substr(0, slash).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if ( dir >= 0 ) {
+		fsync(dir);
+		::close(dir);
+	}
+	*bytes = bodyEnd + table.size();
+	return true;
+}
+
+/**
+ * FUNCTION NAME: open
+ *
+ * DESCRIPTION: Map the snapshot at path and check its header and checksum table. The
+ * 				body is checked lazily, see verify.
+ *
+ * RETURNS:
+ * false if there is no snapshot at path or it is not a valid one
+ */
+bool SnapshotFile::open(const string &path) {
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 ) {
+		if ( errno != ENOENT ) {
+			perror(("SnapshotFile open " + path).c_str());
+		}
+		return false;
+	}
+	struct stat st;
+	if ( fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_HEADER_SIZE ) {
+		::close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping keeps the file open
+	::close(fd);
+	if ( p == MAP_FAILED ) {
+		perror(("SnapshotFile mmap " + path).c_str());
+		return false;
+	}
+	base = (const unsigned char *)p;
+	mapped = st.st_size;
+
+	count = getU64(base + 8);
+	dataSize = getU64(base + 16);
+	indexOffset = getU64(base + 24);
+	bodyEnd = getU64(base + 32);
+	chunks = getU32(base + 40);
+	sequence = getU64(base + 48);
+	bool valid = memcmp(base, SNAPSHOT_MAGIC, 8) == 0 && crc32c(base, 56) == getU32(base + 56)
+			&& indexOffset >= SNAPSHOT_HEADER_SIZE + dataSize && indexOffset % 8 == 0
+			&& bodyEnd >= indexOffset && bodyEnd <= mapped && bodyEnd - indexOffset == 8 * count
+			&& chunks == (bodyEnd - SNAPSHOT_HEADER_SIZE + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK
+			&& mapped >= bodyEnd + 4 * (uint64_t)chunks
+			&& crc32c(base + bodyEnd, 4 * (size_t)chunks) == getU32(base + 44);
+	if ( !valid ) {
+		fprintf(stderr, "SnapshotFile %s: bad header, ignored\n", path.c_str());
+		close();
+		return false;
+	}
+	verified.assign(chunks, 0);
+	corrupt = false;
+	return true;
+}
+
+/**
+ * FUNCTION NAME: close
+ *
+ * DESCRIPTION: Unmap the snapshot
+ */
+void SnapshotFile::close() {
+	if ( base != NULL ) {
+		munmap((void *)base, mapped);
+	}
+	base = NULL;
+	mapped = 0;
+	count = 0;
+	verified.clear();
+}
+
+/**
+ * FUNCTION NAME: verify
+ *
+ * DESCRIPTION: Check the chunks holding the file bytes [from, to) of the body, skipping
+ * 				the ones checked already
+ *
+ * RETURNS:
+ * false if a chunk does not match its checksum, which marks the snapshot corrupt
+ */
+bool SnapshotFile::verify(uint64_t from, uint64_t to) {
+	if ( corrupt || from < SNAPSHOT_HEADER_SIZE || to > bodyEnd ) {
+		corrupt = true;
+		return false;
+	}
+	if ( from >= to ) {
+		return true;
+	}
+	uint64_t first = (from - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_CHUNK;
+	uint64_t last = (to - 1 - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_CHUNK;
+	for ( uint64_t c = first; c <= last; c++ ) {
+		if ( verified[c] ) {
+			continue;
+		}
+		uint64_t start = SNAPSHOT_HEADER_SIZE + c * SNAPSHOT_CHUNK;
+		uint64_t end = min(start + SNAPSHOT_CHUNK, bodyEnd);
+		if ( crc32c(base + start, end - start) != getU32(base + bodyEnd + 4 * c) ) {
+			corrupt = true;
+			return false;
+		}
+		verified[c] = 1;
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: entry
+ *
+ * DESCRIPTION: The i-th pair in key order. key and value point into the mapping and stay
+ * 				valid until the snapshot is closed.
+ *
+ * RETURNS:
+ * false if i is out of range or the bytes of the pair failed their checksum
+ */
+bool SnapshotFile::entry(uint64_t i, string_view *key, string_view *value) {
+	if ( i >= count ) {
+		return false;
+	}
+	uint64_t slot = indexOffset + 8 * i;
+	if ( !verify(slot, slot + 8) ) {
+		return false;
+	}
+	uint64_t start = SNAPSHOT_HEADER_SIZE + getU64(base + slot);
+	uint64_t dataEnd = SNAPSHOT_HEADER_SIZE + dataSize;
+	if ( start >= dataEnd || !verify(start, min(start + 2 * MESSAGE_MAX_VARINT, dataEnd)) ) {
+		corrupt = true;
+		return false;
+	}
+	const unsigned char *p = base + start, *end = base + dataEnd;
+	unsigned int keySize, valueSize;
+	int n = getVarint(p, end, &keySize), m = n < 0 ? -1 : getVarint(p + n, end, &valueSize);
+	if ( m < 0 || (uint64_t)(end - p - n - m) < (uint64_t)keySize + valueSize
+			|| !verify(start, start + n + m + keySize + valueSize) ) {
+		corrupt = true;
+		return false;
+	}
+	*key = string_view((const char *)p + n + m, keySize);
+	*value = string_view(key->data() + keySize, valueSize);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: find
+ *
+ * DESCRIPTION: Binary search the index for key, setting value if it is found
+ *
+ * RETURNS:
+ * false if key is absent, or the snapshot turned out to be corrupt
+ */
+bool SnapshotFile::find(string_view key, string_view *value) {
+	uint64_t lo = 0, hi = count;
+	string_view k, v;
+	while ( lo < hi ) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if ( !entry(mid, &k, &v) ) {
+			return false;
+		}
+		int c = k.compare(key);
+		if ( c == 0 ) {
+			*value = v;
+			return true;
+		}
+		if ( c < 0 ) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return false;
+}
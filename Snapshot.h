@@ -0,0 +1,71 @@
+/**********************************
+ * FILE NAME: Snapshot.h
+ *
+ * DESCRIPTION: Sorted snapshot files of a node's storage engine, header file
+ **********************************/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "stdincludes.h"
+#include "StorageEngine.h"
+
+#define SNAPSHOT_MAGIC "KVSNAP02"
+#define SNAPSHOT_HEADER_SIZE 64
+// Bytes of the body covered by each checksum
+#define SNAPSHOT_CHUNK (64 * 1024)
+
+/**
+ * CLASS NAME: SnapshotFile
+ *
+ * DESCRIPTION: Every pair of a storage engine at one point in time, sorted by key, in a
+ * 				file that is read through mmap. The file is
+ * 					header | data block | index block | checksum table
+ * 				The header holds the counts and offsets, the sequence number of the last
+ * 				write-ahead log record the snapshot holds, and a crc32c of itself. The data block
+ * 				holds each pair as varint key size | varint value size | key | value, and the
+ * 				index block the offset of each pair in the data block, 8 bytes each, so a key
+ * 				is found by binary search without reading the data around it. Data and index
+ * 				form the body, which has a crc32c per SNAPSHOT_CHUNK bytes in the checksum
+ * 				table. Opening only checks the header and the table, each chunk is checked
+ * 				the first time a read touches it, so a file of any size opens at once and
+ * 				pages are only faulted in as they are read. Integers are little endian.
+ */
+class SnapshotFile {
+private:
+	const unsigned char *base;
+	size_t mapped;
+	uint64_t count;
+	uint64_t dataSize;
+	uint64_t indexOffset;
+	uint64_t bodyEnd;
+	uint32_t chunks;
+	uint64_t sequence;
+	// 1 for the chunks whose checksum matched
+	vector<unsigned char> verified;
+	bool corrupt;
+	bool verify(uint64_t from, uint64_t to);
+public:
+	SnapshotFile();
+	~SnapshotFile();
+	bool open(const string &path);
+	void close();
+	bool isOpen() {
+		return base != NULL;
+	}
+	// set once a chunk failed its checksum, no read succeeds after that
+	bool isCorrupt() {
+		return corrupt;
+	}
+	uint64_t size() {
+		return count;
+	}
+	uint64_t walSequence() {
+		return sequence;
+	}
+	bool entry(uint64_t i, string_view *key, string_view *value);
+	bool find(string_view key, string_view *value);
+	static bool write(const string &path, StorageEngine *engine, uint64_t sequence, size_t *bytes);
+};
+
+#endif /* _SNAPSHOT_H_ */
@@ -0,0 +1,94 @@
+/**********************************
+ * FILE NAME: StorageEngine.cpp
+ *
+ * DESCRIPTION: Shared parts of the storage engines and the engine factory
+ **********************************/
+
+#include "StorageEngine.h"
+#include "HashTable.h"
+#include "MapTable.h"
+#include "Hash.h"
+
+/**
+ * FUNCTION NAME: inRange
+ *
+ * DESCRIPTION: Whether token lies in the ring range (from, to]. The range wraps past the
+ * 				largest token when from >= to, and from == to is the whole ring.
+ */
+bool StorageEngine::inRange(uint64_t token, uint64_t from, uint64_t to) {
+	if ( from < to ) {
+		return token > from && token <= to;
+	}
+	return token > from || token <= to;
+}
+
+/**
+ * FUNCTION NAME: forEachInRange
+ *
+ * DESCRIPTION: Visit the pairs whose key has a token in (from, to]. Ordered visits go by
+ * 				token from the start of the range, and by key among equal tokens.
+ * 				This version filters forEach. An engine kept in token order can override it
+ * 				to seek instead.
+ */
+void StorageEngine::forEachInRange(uint64_t from, uint64_t to, bool ordered, const visitor &visit) {
+	if ( !ordered ) {
+		forEach([&](const string &key, const string &value) {
+			if ( inRange(hash64(key), from, to) ) {
+				visit(key, value);
+			}
+		});
+		return;
+	}
+	// Tokens relative to from sort the wrapped part of the range after the rest
+	vector<pair<uint64_t, pair<const string *, const string *>>> found;
+	forEach([&](const string &key, const string &value) {
+		uint64_t token = hash64(key);
+		if ( inRange(token, from, to) ) {
+			found.emplace_back(token - from - 1, make_pair(&key, &value));
+		}
+	});
+	sort(found.begin(), found.end(), [](const auto &a, const auto &b) {
+		return a.first != b.first ? a.first < b.first : *a.second.first < *b.second.first;
+	});
+	for ( auto &f : found ) {
+		visit(*f.second.first, *f.second.second);
+	}
+}
+
+/**
+ * FUNCTION NAME: snapshot
+ *
+ * DESCRIPTION: Copy every pair into entries, sorted by key
+ */
+void StorageEngine::snapshot(vector<pair<string, string>> &entries) {
+	entries.clear();
+	entries.reserve(currentSize());
+	forEach([&](const string &key, const string &value) {
+		entries.emplace_back(key, value);
+	});
+	sort(entries.begin(), entries.end());
+}
+
+/**
+ * FUNCTION NAME: stringBytes
+ *
+ * DESCRIPTION: Heap bytes a string holds beyond its own object, 0 while it fits the
+ * 				small string buffer
+ */
+size_t StorageEngine::stringBytes(const string &s) {
+	return s.capacity() > 15 ? s.capacity() + 1 : 0;
+}
+
+/**
+ * FUNCTION NAME: open
+ *
+ * DESCRIPTION: Create the engine selected by par->STORAGE
+ */
+StorageEngine *StorageEngine::open(Params *par) {
+	switch ( par->STORAGE ) {
+		case MAP_STORAGE:
+			return new MapTable();
+		default:
+			return new HashTable();
+	}
+}
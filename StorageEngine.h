@@ -0,0 +1,64 @@
+/**********************************
+ * FILE NAME: StorageEngine.h
+ *
+ * DESCRIPTION: Interface of the key-value storage of a node
+ **********************************/
+
+#ifndef STORAGEENGINE_H_
+#define STORAGEENGINE_H_
+
+#include "stdincludes.h"
+#include "Params.h"
+
+/**
+ * CLASS NAME: StorageEngine
+ *
+ * DESCRIPTION: Key-value pairs stored by one node. MP2Node only uses this interface, so
+ * 				the engine is picked with the STORAGE setting and engines can be compared
+ * 				under the same workload. Keys are looked up as string_views and values
+ * 				moved in and out. Returned pointers are valid until the next write.
+ * 				Tokens are positions on the key-value ring, as given by hash64 of the key.
+ */
+class StorageEngine {
+public:
+	typedef function<void(const string &key, const string &value)> visitor;
+	virtual ~StorageEngine() {}
+	virtual const char *name() = 0;
+
+	// point operations
+	// insert if absent, NULL if the key was present
+	virtual const string *create(string_view key, string value) = 0;
+	virtual const string *read(string_view key) = 0;
+	// NULL if the key was absent
+	virtual const string *update(string_view key, string newValue, string *oldValue = NULL) = 0;
+	// true if the key was present
+	virtual bool upsert(string_view key, string value, string *oldValue = NULL) = 0;
+	virtual bool deleteKey(string_view key, string *oldValue = NULL) = 0;
+	unsigned long count(string_view key) {
+		return read(key) != NULL ? 1 : 0;
+	}
+
+	// batched writes: entries is left holding the pairs that were inserted
+	virtual void createMany(vector<pair<string, string>> &entries) = 0;
+
+	// iteration, the visitor must not write to the engine
+	virtual void forEach(const visitor &visit) = 0;
+	virtual void forEachInRange(uint64_t from, uint64_t to, bool ordered, const visitor &visit);
+
+	// size and memory
+	virtual unsigned long currentSize() = 0;
+	virtual size_t memoryUsage() = 0;
+	bool isEmpty() {
+		return currentSize() == 0;
+	}
+	virtual void clear() = 0;
+
+	// point in time copy of every pair, sorted by key
+	virtual void snapshot(vector<pair<string, string>> &entries);
+
+	static bool inRange(uint64_t token, uint64_t from, uint64_t to);
+	static size_t stringBytes(const string &s);
+	static StorageEngine *open(Params *par);
+};
+
+#endif /* STORAGEENGINE_H_ */
@@ -0,0 +1,336 @@
+/**********************************
+ * FILE NAME: StorageTest.cpp
+ *
+ * DESCRIPTION: Tests of the storage engines, the write-ahead log and snapshot recovery.
+ * 				Built and run by make test.
+ **********************************/
+
+#include "FlatMap.h"
+#include "HashTable.h"
+#include "MapTable.h"
+#include "Wal.h"
+#include "Snapshot.h"
+#include "WarmingTable.h"
+#include "Random.h"
+#include <errno.h>
+#include <sys/stat.h>
+
+static int failures = 0;
+
+// Report a failed condition and leave the testcase
+#define CHECK(cond) do { \
+	if ( !(cond) ) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+		return; \
+	} \
+} while ( 0 )
+
+static string randomKey(Random &rng, unsigned int keys) {
+	return "key" + to_string(rng.below(keys));
+}
+
+static string randomValue(Random &rng) {
+	// Long enough values now and then to leave the small string buffer
+	return string(1 + rng.below(rng.below(8) == 0 ? 200 : 12), (char)('a' + rng.below(26)));
+}
+
+/**
+ * FUNCTION NAME: sameContents
+ *
+ * DESCRIPTION: Whether engine holds exactly the pairs of expected, checked both by
+ * 				iterating it and by reading every expected key
+ */
+static bool sameContents(StorageEngine *engine, const map<string, string> &expected) {
+	map<string, string> seen;
+	bool duplicate = false;
+	engine->forEach([&](const string &key, const string &value) {
+		duplicate |= !seen.emplace(key, value).second;
+	});
+	if ( duplicate || seen != expected || engine->currentSize() != expected.size() ) {
+		return false;
+	}
+	for ( auto &kv : expected ) {
+		const string *value = engine->read(kv.first);
+		if ( value == NULL || *value != kv.second ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: testFlatMap
+ *
+ * DESCRIPTION: Random inserts, lookups and erases on a FlatMap, checked against std::map
+ * 				after every operation. Few distinct keys keep the table full of tombstones.
+ */
+static void testFlatMap() {
+	Random rng(1, RNG_KVSTORE, 0);
+	FlatMap flat;
+	map<string, string> ref;
+	for ( int op = 0; op < 300000; op++ ) {
+		string key = randomKey(rng, op < 200000 ? 5000 : 200);
+		auto it = ref.find(key);
+		switch ( rng.below(10) ) {
+			case 0: case 1: case 2: {
+				string value = randomValue(rng);
+				pair<FlatMap::value_type *, bool> r = flat.insert(key, string(value));
+				CHECK(r.second == (it == ref.end()));
+				CHECK(r.first->first == key);
+				if ( r.second ) {
+					ref[key] = value;
+				}
+				CHECK(r.first->second == ref[key]);
+				break;
+			}
+			case 3: case 4: {
+				string old;
+				CHECK(flat.erase(key, &old) == (it != ref.end()));
+				if ( it != ref.end() ) {
+					CHECK(old == it->second);
+					ref.erase(it);
+				}
+				break;
+			}
+			case 5:
+				if ( rng.below(1000) == 0 ) {
+					flat.reserve(flat.size() + rng.below(10000));
+				}
+				else if ( rng.below(5000) == 0 ) {
+					flat.clear();
+					ref.clear();
+				}
+				break;
+			default: {
+				FlatMap::value_type *found = flat.find(key);
+				CHECK((found != NULL) == (it != ref.end()));
+				CHECK(found == NULL || found->second == it->second);
+				break;
+			}
+		}
+		CHECK(flat.size() == ref.size());
+	}
+	map<string, string> seen;
+	for ( auto &kv : flat ) {
+		CHECK(seen.emplace(kv.first, kv.second).second);
+	}
+	CHECK(seen == ref);
+}
+
+/**
+ * FUNCTION NAME: testEngines
+ *
+ * DESCRIPTION: The same random writes on the flat and the map engine, checked against
+ * 				std::map, including batched creates and the keys of token ranges
+ */
+static void testEngines() {
+	Random rng(2, RNG_KVSTORE, 0);
+	HashTable flat;
+	MapTable tree;
+	StorageEngine *engines[2] = { &flat, &tree };
+	map<string, string> ref;
+	for ( int op = 0; op < 100000; op++ ) {
+		string key = randomKey(rng, 3000), value = randomValue(rng);
+		bool present = ref.count(key) != 0;
+		unsigned int kind = rng.below(6);
+		for ( StorageEngine *engine : engines ) {
+			string old;
+			switch ( kind ) {
+				case 0:
+					CHECK((engine->create(key, value) != NULL) == !present);
+					break;
+				case 1:
+					CHECK((engine->update(key, value, &old) != NULL) == present);
+					CHECK(!present || old == ref[key]);
+					break;
+				case 2:
+					CHECK(engine->upsert(key, value, &old) == present);
+					CHECK(!present || old == ref[key]);
+					break;
+				case 3:
+					CHECK(engine->deleteKey(key, &old) == present);
+					CHECK(!present || old == ref[key]);
+					break;
+				case 4: {
+					vector<pair<string, string>> entries;
+					entries.emplace_back(key, value);
+					engine->createMany(entries);
+					CHECK(entries.size() == (present ? 0u : 1u));
+					break;
+				}
+				default: {
+					const string *found = engine->read(key);
+					CHECK((found != NULL) == present);
+					CHECK(found == NULL || *found == ref[key]);
+					break;
+				}
+			}
+		}
+		if ( kind == 3 ) {
+			ref.erase(key);
+		}
+		else if ( (kind == 1 && present) || kind == 2 || ((kind == 0 || kind == 4) && !present) ) {
+			ref[key] = value;
+		}
+		CHECK(flat.currentSize() == ref.size() && tree.currentSize() == ref.size());
+	}
+	for ( StorageEngine *engine : engines ) {
+		CHECK(sameContents(engine, ref));
+		for ( int r = 0; r < 20; r++ ) {
+			uint64_t from = rng.next(), to = rng.next();
+			set<string> expected, seen;
+			for ( auto &kv : ref ) {
+				if ( StorageEngine::inRange(hash64(kv.first), from, to) ) {
+					expected.insert(kv.first);
+				}
+			}
+			engine->forEachInRange(from, to, false, [&](const string &key, const string &value) {
+				seen.insert(key);
+			});
+			CHECK(seen == expected);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: logWrites
+ *
+ * DESCRIPTION: Apply count random writes to ref and log them to wal, committing every
+ * 				few writes as a tick would
+ */
+static void logWrites(Random &rng, WriteAheadLog &wal, map<string, string> &ref, int count) {
+	for ( int i = 0; i < count; i++ ) {
+		string key = randomKey(rng, 500);
+		if ( rng.below(4) == 0 ) {
+			wal.append(WAL_DELETE, key, "");
+			ref.erase(key);
+		}
+		else {
+			string value = randomValue(rng);
+			wal.append(WAL_SET, key, value);
+			ref[key] = value;
+		}
+		if ( rng.below(8) == 0 ) {
+			wal.commit(i);
+		}
+	}
+	wal.commit(count);
+}
+
+static off_t fileSize(const string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+/**
+ * FUNCTION NAME: testWalRecovery
+ *
+ * DESCRIPTION: A reopened log restores every logged write. A torn record at the end is
+ * 				cut off, and records appended after that are replayed next time.
+ */
+static void testWalRecovery(const string &dir) {
+	Random rng(3, RNG_KVSTORE, 0);
+	string path = dir + "/recovery.wal";
+	map<string, string> ref;
+	{
+		WriteAheadLog wal;
+		CHECK(wal.open(path, WAL_NO_SYNC, 1));
+		logWrites(rng, wal, ref, 2000);
+		CHECK(wal.lastSequence() == 2000);
+	}
+	off_t good = fileSize(path);
+	FILE *fp = fopen(path.c_str(), "a");
+	CHECK(fp != NULL);
+	// A header promising more bytes than follow it, as a crash in the middle of a write leaves
+	const char torn[] = "\x12\x34\x56\x78\x40\x00\x00\x00torn";
+	fwrite(torn, 1, sizeof(torn) - 1, fp);
+	fclose(fp);
+	{
+		WriteAheadLog wal;
+		HashTable engine;
+		CHECK(wal.open(path, WAL_NO_SYNC, 1));
+		CHECK(wal.replay(&engine, 0) == 2000);
+		CHECK(sameContents(&engine, ref));
+		CHECK(fileSize(path) == good);
+		CHECK(wal.lastSequence() == 2000);
+		logWrites(rng, wal, ref, 100);
+	}
+	WriteAheadLog wal;
+	HashTable engine;
+	CHECK(wal.open(path, WAL_NO_SYNC, 1));
+	CHECK(wal.replay(&engine, 0) == 2100);
+	CHECK(sameContents(&engine, ref));
+}
+
+/**
+ * FUNCTION NAME: testSnapshotRecovery
+ *
+ * DESCRIPTION: A snapshot plus the log written after it restore every write, whether or
+ * 				not the log was truncated when the snapshot was taken: replay skips the
+ * 				records the snapshot holds. A snapshot with a damaged header is ignored.
+ */
+static void testSnapshotRecovery(const string &dir) {
+	string walPath = dir + "/snapshot.wal", snapPath = dir + "/snapshot.snap";
+	for ( int truncated = 0; truncated < 2; truncated++ ) {
+		Random rng(4 + truncated, RNG_KVSTORE, 0);
+		map<string, string> ref;
+		unlink(walPath.c_str());
+		unlink(snapPath.c_str());
+		{
+			WriteAheadLog wal;
+			HashTable engine;
+			size_t bytes;
+			CHECK(wal.open(walPath, WAL_NO_SYNC, 1));
+			logWrites(rng, wal, ref, 3000);
+			for ( auto &kv : ref ) {
+				engine.upsert(kv.first, kv.second);
+			}
+			CHECK(SnapshotFile::write(snapPath, &engine, wal.lastSequence(), &bytes));
+			CHECK(bytes == (size_t)fileSize(snapPath));
+			if ( truncated ) {
+				CHECK(wal.truncate());
+			}
+			logWrites(rng, wal, ref, 500);
+		}
+		WriteAheadLog wal;
+		WarmingTable *table = new WarmingTable(new HashTable());
+		CHECK(wal.open(walPath, WAL_NO_SYNC, 1));
+		CHECK(table->open(snapPath));
+		CHECK(table->snapshotSequence() == 3000);
+		CHECK(wal.replay(table, table->snapshotSequence()) == 500);
+		CHECK(wal.lastSequence() == 3500);
+		CHECK(sameContents(table, ref));
+		while ( table->warm(64) ) {
+		}
+		StorageEngine *engine = table->release();
+		delete table;
+		CHECK(sameContents(engine, ref));
+		delete engine;
+	}
+
+	FILE *fp = fopen(snapPath.c_str(), "r+");
+	CHECK(fp != NULL);
+	fseek(fp, 48, SEEK_SET);
+	fputc(0xff, fp);
+	fclose(fp);
+	SnapshotFile damaged;
+	CHECK(!damaged.open(snapPath));
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/storagetestXXXXXX";
+	if ( mkdtemp(dir) == NULL ) {
+		perror("mkdtemp");
+		return 1;
+	}
+	testFlatMap();
+	testEngines();
+	testWalRecovery(dir);
+	testSnapshotRecovery(dir);
+	if ( system(("rm -rf " + string(dir)).c_str()) != 0 ) {
+		fprintf(stderr, "could not remove %s\n", dir);
+	}
+	printf("%s\n", failures == 0 ? "All storage tests passed" : "Storage tests FAILED");
+	return failures == 0 ? 0 : 1;
+}
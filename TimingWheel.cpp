@@ -0,0 +1,215 @@
+/**********************************
+ * FILE NAME: TimingWheel.cpp
+ *
+ * DESCRIPTION: Hierarchical timing wheel definition
+ **********************************/
+
+#include "TimingWheel.h"
+#include "EmulNet.h"
+
+/**
+ * Append em to the tail of slot s
+ */
+static void append(wheel_slot &s, en_msg *em) {
+	em->next = NULL;
+	if ( s.tail ) {
+		s.tail->next = em;
+	}
+	else {
+		s.head = em;
+	}
+	s.tail = em;
+}
+
+/**
+ * Remove em from slot s
+ *
+ * RETURNS:
+ * false if em is not in s
+ */
+static bool unlink(wheel_slot &s, en_msg *em) {
+	en_msg *prev = NULL;
+	for ( en_msg *cur = s.head; cur; prev = cur, cur = cur->next ) {
+		if ( cur != em ) {
+			continue;
+		}
+		if ( prev ) {
+			prev->next = cur->next;
+		}
+		else {
+			s.head = cur->next;
+		}
+		if ( s.tail == cur ) {
+			s.tail = prev;
+		}
+		cur->next = NULL;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Constructor
+ */
+TimingWheel::TimingWheel() {
+	now = 0;
+	count = 0;
+	memset(slots, 0, sizeof(slots));
+}
+
+/**
+ * FUNCTION NAME: slotFor
+ *
+ * DESCRIPTION: Slot of the lowest level whose span still separates deliverAt from now
+ */
+wheel_slot &TimingWheel::slotFor(int deliverAt) {
+	unsigned int diff = (unsigned int)(deliverAt ^ now);
+	int level;
+
+	for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+		if ( diff < (1u << (WHEEL_BITS * (level + 1))) ) {
+			return slots[level][(deliverAt >> (WHEEL_BITS * level)) & WHEEL_MASK];
+		}
+	}
+	// Beyond the horizon: park in the slot the top level reaches last
+	level = WHEEL_LEVELS - 1;
+	return slots[level][((now >> (WHEEL_BITS * level)) - 1) & WHEEL_MASK];
+}
+
+/**
+ * FUNCTION NAME: place
+ *
+ * DESCRIPTION: Put em in the slot of its delivery tick
+ */
+void TimingWheel::place(en_msg *em) {
+	append(slotFor(em->deliverAt), em);
+}
+
+/**
+ * FUNCTION NAME: cascade
+ *
+ * DESCRIPTION: Re-place every message of one slot relative to the current tick
+ */
+void TimingWheel::cascade(int level, int index) {
+	en_msg *em = slots[level][index].head;
+	slots[level][index].head = NULL;
+	slots[level][index].tail = NULL;
+	while ( em ) {
+		en_msg *next = em->next;
+		place(em);
+		em = next;
+	}
+}
+
+/**
+ * FUNCTION NAME: schedule
+ *
+ * DESCRIPTION: Add a message. em->deliverAt must be later than getNow().
+ */
+void TimingWheel::schedule(en_msg *em) {
+	place(em);
+	count++;
+}
+
+/**
+ * FUNCTION NAME: reschedule
+ *
+ * DESCRIPTION: Move a scheduled message to tick deliverAt. It is looked for in the slot
+ * 				it was placed in, and in every slot should the wheel have turned since.
+ */
+void TimingWheel::reschedule(en_msg *em, int deliverAt) {
+	if ( !unlink(slotFor(em->deliverAt), em) ) {
+		bool found = false;
+		for ( int level = 0; level < WHEEL_LEVELS && !found; level++ ) {
+			for ( int i = 0; i < WHEEL_SLOTS && !found; i++ ) {
+				found = unlink(slots[level][i], em);
+			}
+		}
+		if ( !found ) {
+			return;
+		}
+	}
+	em->deliverAt = deliverAt;
+	place(em);
+}
+
+/**
+ * FUNCTION NAME: advance
+ *
+ * DESCRIPTION: Move the wheel forward to tick time
+ *
+ * RETURNS:
+ * the messages that became due, linked through next, in delivery order
+ */
+en_msg *TimingWheel::advance(int time) {
+	wheel_slot due = {NULL, NULL};
+	int level;
+
+	if ( count == 0 ) {
+		if ( time > now ) {
+			now = time;
+		}
+		return NULL;
+	}
+	while ( now < time && count > 0 ) {
+		now++;
+		// Higher levels first, so their messages can land in this tick's level 0 slot
+		for ( level = WHEEL_LEVELS - 1; level > 0; level-- ) {
+			if ( (now & ((1 << (WHEEL_BITS * level)) - 1)) == 0 ) {
+				cascade(level, (now >> (WHEEL_BITS * level)) & WHEEL_MASK);
+			}
+		}
+		wheel_slot &s = slots[0][now & WHEEL_MASK];
+		if ( s.head ) {
+			if ( due.tail ) {
+				due.tail->next = s.head;
+			}
+			else {
+				due.head = s.head;
+			}
+			due.tail = s.tail;
+			s.head = NULL;
+			s.tail = NULL;
+		}
+	}
+	if ( now < time ) {
+		now = time;
+	}
+	for ( en_msg *em = due.head; em; em = em->next ) {
+		count--;
+	}
+	return due.head;
+}
+
+/**
+ * FUNCTION NAME: drain
+ *
+ * DESCRIPTION: Remove every message regardless of its delivery tick
+ *
+ * RETURNS:
+ * the removed messages, linked through next
+ */
+en_msg *TimingWheel::drain() {
+	wheel_slot all = {NULL, NULL};
+	int level, i;
+
+	for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+		for ( i = 0; i < WHEEL_SLOTS; i++ ) {
+			wheel_slot &s = slots[level][i];
+			if ( s.head == NULL ) {
+				continue;
+			}
+			if ( all.tail ) {
+				all.tail->next = s.head;
+			}
+			else {
+				all.head = s.head;
+			}
+			all.tail = s.tail;
+			s.head = NULL;
+			s.tail = NULL;
+		}
+	}
+	count = 0;
+	return all.head;
+}
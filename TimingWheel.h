@@ -0,0 +1,62 @@
+/**********************************
+ * FILE NAME: TimingWheel.h
+ *
+ * DESCRIPTION: Hierarchical timing wheel header file
+ **********************************/
+
+#ifndef _TIMINGWHEEL_H_
+#define _TIMINGWHEEL_H_
+
+#include "stdincludes.h"
+
+// Each level has 2^WHEEL_BITS slots, a slot of level l spans 2^(WHEEL_BITS * l) ticks
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+struct en_msg;
+
+/**
+ * Struct Name: wheel_slot
+ *
+ * DESCRIPTION: Intrusive FIFO of messages, linked through en_msg::next
+ */
+typedef struct wheel_slot {
+	struct en_msg *head;
+	struct en_msg *tail;
+}wheel_slot;
+
+/**
+ * CLASS NAME: TimingWheel
+ *
+ * DESCRIPTION: Holds messages until their delivery tick (en_msg::deliverAt).
+ * 				Scheduling is O(1). Level 0 resolves single ticks, higher levels
+ * 				are cascaded down as time reaches them, so every message moves at
+ * 				most WHEEL_LEVELS times. Messages further out than the top level
+ * 				are parked in its last slot and re-placed when it comes around.
+ */
+class TimingWheel {
+private:
+	// Last tick advanced to
+	int now;
+	int count;
+	wheel_slot slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	wheel_slot &slotFor(int deliverAt);
+	void place(struct en_msg *em);
+	void cascade(int level, int index);
+public:
+	TimingWheel();
+	void schedule(struct en_msg *em);
+	void reschedule(struct en_msg *em, int deliverAt);
+	struct en_msg *advance(int time);
+	struct en_msg *drain();
+	int getNow() {
+		return now;
+	}
+	int size() {
+		return count;
+	}
+};
+
+#endif /* _TIMINGWHEEL_H_ */
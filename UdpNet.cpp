@@ -0,0 +1,262 @@
+/**********************************
+ * FILE NAME: UdpNet.cpp
+ *
+ * DESCRIPTION: Loopback UDP transport definition
+ **********************************/
+
+#include "UdpNet.h"
+
+/**
+ * Constructor
+ */
+UdpNet::UdpNet(Params *p, int basePort, int netId, const char *name): EmulNet(p, netId, name) {
+	this->basePort = basePort;
+	recvbuf.resize(UDP_BATCH * par->MAX_MSG_SIZE);
+}
+
+/**
+ * Destructor
+ */
+UdpNet::~UdpNet() {
+	for ( size_t i = 0; i < endpoints.size(); i++ ) {
+		if ( endpoints[i].fd >= 0 ) {
+			close(endpoints[i].fd);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: portOf
+ *
+ * DESCRIPTION: Local port an address is bound to
+ */
+unsigned short UdpNet::portOf(Address *addr) {
+	int id = *(int *)(addr->addr);
+	short port = *(short *)(&addr->addr[4]);
+	return (unsigned short)(basePort + id + port);
+}
+
+/**
+ * FUNCTION NAME: endpointFor
+ *
+ * DESCRIPTION: Return the socket of a node, opening and binding it on first use
+ *
+ * RETURNS:
+ * the endpoint, or NULL if the socket could not be set up
+ */
+udp_endpoint *UdpNet::endpointFor(Address *addr) {
+	int id = *(int *)(addr->addr);
+	if ( id < 0 ) {
+		return NULL;
+	}
+	if ( id >= (int)endpoints.size() ) {
+		udp_endpoint unused;
+		unused.fd = -1;
+		endpoints.resize(id + 1, unused);
+	}
+	udp_endpoint *ep = &endpoints[id];
+	if ( ep->fd >= 0 ) {
+		return ep;
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if ( fd < 0 ) {
+		perror("UdpNet socket");
+		return NULL;
+	}
+	int rcvbuf = UDP_RCVBUF;
+	// SO_RCVBUFFORCE may exceed rmem_max but needs privileges
+	if ( setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0 ) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(portOf(addr));
+	if ( bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ) {
+		perror("UdpNet bind");
+		close(fd);
+		return NULL;
+	}
+	ep->fd = fd;
+	ep->sendbuf.reserve(UDP_BATCH * par->MAX_MSG_SIZE);
+	return ep;
+}
+
+/**
+ * FUNCTION NAME: ENinit
+ *
+ * DESCRIPTION: Assign the node its id and bind its socket
+ */
+void *UdpNet::ENinit(Address *myaddr, short port) {
+	EmulNet::ENinit(myaddr, port);
+	endpointFor(myaddr);
+	return myaddr;
+}
+
+/**
+ * FUNCTION NAME: ENsend
+ *
+ * DESCRIPTION: Queue a datagram in the sender's batch. The batch goes out with one
+ * 				sendmmsg when it is full or before the next receive.
+ *
+ * RETURNS:
+ * size
+ */
+int UdpNet::ENsend(Address *myaddr, Address *toaddr, char *data, int size) {
+	int sendmsg = rngFor(*(int *)(myaddr->addr)).below(100);
+
+	if( (size < 0) || (size > ENmaxPayload()) || (par->dropmsg && sendmsg < (int) (par->MSG_DROP_PROB * 100)) ) {
+		return 0;
+	}
+
+	int src = *(int *)(myaddr->addr);
+	udp_endpoint *ep = endpointFor(myaddr);
+	if ( ep == NULL || *(int *)(toaddr->addr) < 0 || par->isolated(src, *(int *)(toaddr->addr)) ) {
+		return 0;
+	}
+
+	if ( ep->pending.empty() ) {
+		dirty.push_back(src);
+	}
+	udp_dgram dg;
+	dg.offset = ep->sendbuf.size();
+	dg.size = size;
+	dg.port = portOf(toaddr);
+	ep->sendbuf.insert(ep->sendbuf.end(), data, data + size);
+	ep->pending.push_back(dg);
+
+	countSent(src, *(int *)(toaddr->addr), data, size);
+	counterFor(src).countSentFrame(par->getcurrtime());
+
+	if ( ep->pending.size() >= UDP_BATCH ) {
+		flush(src);
+	}
+	return size;
+}
+
+/**
+ * FUNCTION NAME: flush
+ *
+ * DESCRIPTION: Send the pending batch of node id with sendmmsg
+ */
+void UdpNet::flush(int id) {
+	udp_endpoint *ep = &endpoints[id];
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	struct sockaddr_in addrs[UDP_BATCH];
+	size_t done = 0;
+
+	while ( done < ep->pending.size() ) {
+		int n = 0;
+		for ( size_t i = done; i < ep->pending.size() && n < UDP_BATCH; i++, n++ ) {
+			udp_dgram &dg = ep->pending[i];
+			memset(&addrs[n], 0, sizeof(addrs[n]));
+			addrs[n].sin_family = AF_INET;
+			addrs[n].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addrs[n].sin_port = htons(dg.port);
+			iovs[n].iov_base = &ep->sendbuf[dg.offset];
+			iovs[n].iov_len = dg.size;
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addrs[n];
+			msgs[n].msg_hdr.msg_namelen = sizeof(addrs[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+		}
+		int sent = sendmmsg(ep->fd, msgs, n, 0);
+		if ( sent < 0 && errno == EINTR ) {
+			continue;
+		}
+		if ( sent <= 0 ) {
+			// A full socket buffer loses the rest of the batch, like a congested link. The
+			// losses are counted so msgcount.log shows them.
+			if ( sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS ) {
+				perror("UdpNet sendmmsg");
+			}
+			counterFor(id).countSendDropped(ep->pending.size() - done);
+			break;
+		}
+		done += sent;
+	}
+	ep->pending.clear();
+	ep->sendbuf.clear();
+}
+
+/**
+ * FUNCTION NAME: flushAll
+ *
+ * DESCRIPTION: Flush every endpoint that has a pending batch
+ */
+void UdpNet::flushAll() {
+	for ( size_t i = 0; i < dirty.size(); i++ ) {
+		if ( !endpoints[dirty[i]].pending.empty() ) {
+			flush(dirty[i]);
+		}
+	}
+	dirty.clear();
+}
+
+/**
+ * FUNCTION NAME: ENrecv
+ *
+ * DESCRIPTION: Flush pending batches, then drain this node's socket with recvmmsg
+ *
+ * RETURN:
+ * 0
+ */
+int UdpNet::ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct timeval *t, int times, void *queue) {
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	struct sockaddr_in addrs[UDP_BATCH];
+	int dst = *(int *)(myaddr->addr);
+	int n, i;
+
+	flushAll();
+	udp_endpoint *ep = endpointFor(myaddr);
+	if ( ep == NULL ) {
+		return 0;
+	}
+	MsgCounter &counter = counterFor(dst);
+
+	do {
+		for ( i = 0; i < UDP_BATCH; i++ ) {
+			iovs[i].iov_base = &recvbuf[i * par->MAX_MSG_SIZE];
+			iovs[i].iov_len = par->MAX_MSG_SIZE;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		n = recvmmsg(ep->fd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		for ( i = 0; i < n; i++ ) {
+			int sz = msgs[i].msg_len;
+			char *tmp = (char *) malloc(sz * sizeof(char));
+			memcpy(tmp, iovs[i].iov_base, sz);
+			// Every address binds basePort + id, its port part is always 0
+			countRecv(ntohs(addrs[i].sin_port) - basePort, dst, tmp, sz);
+			counter.countRecvFrame(par->getcurrtime());
+			(*enq)(queue, tmp, sz);
+		}
+	} while ( n == UDP_BATCH );
+
+	return 0;
+}
+
+/**
+ * FUNCTION NAME: ENcleanup
+ *
+ * DESCRIPTION: Flush what is still pending, close the sockets and write the message counts
+ */
+int UdpNet::ENcleanup() {
+	flushAll();
+	for ( size_t i = 0; i < endpoints.size(); i++ ) {
+		if ( endpoints[i].fd >= 0 ) {
+			close(endpoints[i].fd);
+			endpoints[i].fd = -1;
+		}
+	}
+	return EmulNet::ENcleanup();
+}
@@ -0,0 +1,77 @@
+/**********************************
+ * FILE NAME: UdpNet.h
+ *
+ * DESCRIPTION: Loopback UDP transport header file
+ **********************************/
+
+#ifndef _UDPNET_H_
+#define _UDPNET_H_
+
+// Datagrams moved per sendmmsg / recvmmsg call
+#define UDP_BATCH 64
+// Requested receive buffer per socket
+#define UDP_RCVBUF (4 * 1024 * 1024)
+
+#include "stdincludes.h"
+#include "EmulNet.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+
+/**
+ * Struct Name: udp_dgram
+ *
+ * DESCRIPTION: A datagram waiting in an endpoint's send batch
+ */
+typedef struct udp_dgram {
+	// Offset of the payload in udp_endpoint::sendbuf
+	int offset;
+	int size;
+	unsigned short port;
+}udp_dgram;
+
+/**
+ * Struct Name: udp_endpoint
+ *
+ * DESCRIPTION: Socket of one node and its pending send batch
+ */
+typedef struct udp_endpoint {
+	int fd;
+	vector<char> sendbuf;
+	vector<udp_dgram> pending;
+}udp_endpoint;
+
+/**
+ * CLASS NAME: UdpNet
+ *
+ * DESCRIPTION: Transport with the EmulNet contract that moves messages over 127.0.0.1.
+ * 				Every Address id:port is bound to local port basePort + id + port.
+ * 				Sends are batched per node and flushed with sendmmsg, receives are
+ * 				drained with recvmmsg.
+ */
+class UdpNet : public EmulNet
+{
+private:
+	int basePort;
+	// endpoints[id] is the socket of node id, fd -1 until first use
+	vector<udp_endpoint> endpoints;
+	// ids of endpoints that have a pending send batch
+	vector<int> dirty;
+	// scratch space for one recvmmsg batch
+	vector<char> recvbuf;
+	unsigned short portOf(Address *addr);
+	udp_endpoint *endpointFor(Address *addr);
+	void flush(int id);
+	void flushAll();
+public:
+	UdpNet(Params *p, int basePort, int netId = 0, const char *name = "net");
+	virtual ~UdpNet();
+	void *ENinit(Address *myaddr, short port);
+	using EmulNet::ENsend;
+	int ENsend(Address *myaddr, Address *toaddr, char *data, int size);
+	int ENrecv(Address *myaddr, int (* enq)(void *, char *, int), struct timeval *t, int times, void *queue);
+	int ENcleanup();
+};
+
+#endif /* _UDPNET_H_ */
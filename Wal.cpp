@@ -0,0 +1,265 @@
+/**********************************
+ * FILE NAME: Wal.cpp
+ *
+ * DESCRIPTION: Definition of WriteAheadLog
+ **********************************/
+
+#include "Wal.h"
+#include "Crc.h"
+#include "Message.h"
+#include <errno.h>
+#include <sys/stat.h>
+
+static inline void putU32(char *p, uint32_t v) {
+	p[0] = (char)(v & 0xff);
+	p[1] = (char)((v >> 8) & 0xff);
+	p[2] = (char)((v >> 16) & 0xff);
+	p[3] = (char)((v >> 24) & 0xff);
+}
+
+static inline uint32_t getU32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void putU64(char *p, uint64_t v) {
+	putU32(p, (uint32_t)v);
+	putU32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint64_t getU64(const unsigned char *p) {
+	return (uint64_t)getU32(p) | ((uint64_t)getU32(p + 4) << 32);
+}
+
+/**
+ * Constructor
+ */
+WriteAheadLog::WriteAheadLog(): fd(-1), policy(WAL_NO_SYNC), interval(1), size(0), sequence(0), unsynced(false), lastSync(0),
+		records(0), commits(0), syncs(0), truncations(0) {}
+
+/**
+ * Destructor
+ */
+WriteAheadLog::~WriteAheadLog() {
+	close();
+}
+
+/**
+ * FUNCTION NAME: open
+ *
+ * DESCRIPTION: Open the log at path, creating it if needed. Records are appended after
+ * 				the ones already there, so replay them first.
+ */
+bool WriteAheadLog::open(const string &path, int policy, int interval) {
+	close();
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if ( fd < 0 ) {
+		perror(("WriteAheadLog open " + path).c_str());
+		return false;
+	}
+	struct stat st;
+	size = fstat(fd, &st) == 0 ? st.st_size : 0;
+	this->path = path;
+	this->policy = policy;
+	this->interval = max(interval, 1);
+	return true;
+}
+
+/**
+ * FUNCTION NAME: close
+ *
+ * DESCRIPTION: Commit what is pending and close the file
+ */
+void WriteAheadLog::close() {
+	if ( fd < 0 ) {
+		return;
+	}
+	// A tick far enough ahead makes WAL_SYNC_INTERVAL sync as well
+	commit(lastSync + interval);
+	::close(fd);
+	fd = -1;
+}
+
+/**
+ * FUNCTION NAME: append
+ *
+ * DESCRIPTION: Add a record to the next commit. The value of a WAL_DELETE is empty.
+ */
+void WriteAheadLog::append(walRecordTYPE type, string_view key, string_view value) {
+	char varint[MESSAGE_MAX_VARINT];
+	size_t start = buffer.size();
+
+	buffer.resize(start + WAL_HEADER_SIZE + WAL_BODY_PREFIX);
+	buffer[start + WAL_HEADER_SIZE] = (char)type;
+	putU64(&buffer[start + WAL_HEADER_SIZE + 1], ++sequence);
+	buffer.append(varint, putVarint(varint, (unsigned int)key.size()));
+	buffer.append(key);
+	buffer.append(value);
+	uint32_t length = (uint32_t)(buffer.size() - start - WAL_HEADER_SIZE);
+	putU32(&buffer[start + 4], length);
+	putU32(&buffer[start], crc32c(&buffer[start + 4], length + 4));
+	records++;
+}
+
+/**
+ * FUNCTION NAME: writeAll
+ *
+ * DESCRIPTION: write() until every byte is out
+ */
+bool WriteAheadLog::writeAll(const char *data, size_t size) {
+	while ( size > 0 ) {
+		ssize_t n = write(fd, data, size);
+		if ( n < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			perror(("WriteAheadLog write " + path).c_str());
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: commit
+ *
+ * DESCRIPTION: Write the records appended since the last commit with one write, then
+ * 				fdatasync as the policy asks: after every commit for WAL_SYNC_ALWAYS, at
+ * 				most every interval ticks for WAL_SYNC_INTERVAL, never for WAL_NO_SYNC, which
+ * 				leaves it to the kernel. now is the current tick.
+ * 				If the write fails, the part that made it to the file is cut off again and
+ * 				the records stay pending for the next commit. If the sync fails, the next
+ * 				commit syncs again.
+ *
+ * RETURNS:
+ * false if the records could not be written or synced
+ */
+bool WriteAheadLog::commit(long long now) {
+	if ( fd < 0 ) {
+		return false;
+	}
+	if ( !buffer.empty() ) {
+		if ( !writeAll(buffer.data(), buffer.size()) ) {
+			// A torn record would stop replay before every record written after it
+			if ( ftruncate(fd, size) < 0 ) {
+				perror(("WriteAheadLog truncate " + path).c_str());
+			}
+			return false;
+		}
+		size += buffer.size();
+		buffer.clear();
+		unsynced = true;
+		commits++;
+	}
+	if ( unsynced && (policy == WAL_SYNC_ALWAYS || (policy == WAL_SYNC_INTERVAL && now - lastSync >= interval)) ) {
+		if ( fdatasync(fd) < 0 ) {
+			perror(("WriteAheadLog fdatasync " + path).c_str());
+			return false;
+		}
+		unsynced = false;
+		lastSync = now;
+		syncs++;
+	}
+	return true;
+}
+
+/**
+ * FUNCTION NAME: truncate
+ *
+ * DESCRIPTION: Drop every record, written or pending, once a snapshot holds the writes
+ * 				they logged. New records start the file over. If the file cannot be
+ * 				truncated nothing is dropped.
+ */
+bool WriteAheadLog::truncate() {
+	if ( fd < 0 ) {
+		return false;
+	}
+	if ( ftruncate(fd, 0) < 0 ) {
+		perror(("WriteAheadLog truncate " + path).c_str());
+		return false;
+	}
+	size = 0;
+	buffer.clear();
+	unsynced = false;
+	if ( policy != WAL_NO_SYNC ) {
+		fdatasync(fd);
+	}
+	truncations++;
+	return true;
+}
+
+/**
+ * FUNCTION NAME: replay
+ *
+ * DESCRIPTION: Apply the records of the file numbered above after to engine, in order.
+ * 				after is the last record a snapshot loaded into engine holds, 0 if there is
+ * 				none. Reading stops at the first record that is cut short or fails its
+ * 				checksum, a write the process did not finish, and the file is truncated there
+ * 				so new records follow the last good one. New records are numbered after
+ * 				both the snapshot and the log.
+ *
+ * RETURNS:
+ * number of records applied, -1 if the file could not be read
+ */
+long long WriteAheadLog::replay(StorageEngine *engine, uint64_t after) {
+	if ( fd < 0 ) {
+		return -1;
+	}
+	string data;
+	char chunk[1 << 16];
+	ssize_t n;
+	if ( lseek(fd, 0, SEEK_SET) < 0 ) {
+		perror(("WriteAheadLog seek " + path).c_str());
+		return -1;
+	}
+	while ( (n = read(fd, chunk, sizeof(chunk))) != 0 ) {
+		if ( n < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			perror(("WriteAheadLog read " + path).c_str());
+			return -1;
+		}
+		data.append(chunk, n);
+	}
+
+	const unsigned char *p = (const unsigned char *)data.data();
+	const unsigned char *end = p + data.size();
+	long long applied = 0;
+	sequence = after;
+	while ( end - p >= WAL_HEADER_SIZE ) {
+		uint32_t length = getU32(p + 4);
+		if ( length <= WAL_BODY_PREFIX || (size_t)(end - p - WAL_HEADER_SIZE) < length
+				|| crc32c(p + 4, length + 4) != getU32(p) ) {
+			break;
+		}
+		const unsigned char *body = p + WAL_HEADER_SIZE, *bodyEnd = body + length;
+		uint64_t seq = getU64(body + 1);
+		unsigned int keySize;
+		int used = getVarint(body + WAL_BODY_PREFIX, bodyEnd, &keySize);
+		if ( used < 0 || keySize > (size_t)(bodyEnd - body - WAL_BODY_PREFIX - used) || (body[0] != WAL_SET && body[0] != WAL_DELETE) ) {
+			break;
+		}
+		p = bodyEnd;
+		sequence = max(sequence, seq);
+		if ( seq <= after ) {
+			continue;
+		}
+		string_view key((const char *)body + WAL_BODY_PREFIX + used, keySize);
+		string_view value(key.data() + keySize, (const char *)bodyEnd - key.data() - keySize);
+		if ( body[0] == WAL_SET ) {
+			engine->upsert(key, string(value));
+		}
+		else {
+			engine->deleteKey(key);
+		}
+		applied++;
+	}
+	size_t good = p - (const unsigned char *)data.data();
+	if ( good < data.size() && ftruncate(fd, good) < 0 ) {
+		perror(("WriteAheadLog truncate " + path).c_str());
+	}
+	size = good;
+	return applied;
+}
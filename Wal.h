@@ -0,0 +1,80 @@
+/**********************************
+ * FILE NAME: Wal.h
+ *
+ * DESCRIPTION: Write-ahead log of the writes to a node's storage engine, header file
+ **********************************/
+
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include "stdincludes.h"
+#include "Params.h"
+#include "StorageEngine.h"
+
+// crc32c and length that start every record
+#define WAL_HEADER_SIZE 8
+// type and sequence number that follow them
+#define WAL_BODY_PREFIX 9
+
+enum walRecordTYPE { WAL_SET = 1, WAL_DELETE };
+
+/**
+ * CLASS NAME: WriteAheadLog
+ *
+ * DESCRIPTION: Append-only file of the writes applied to one node's storage engine, so
+ * 				a restarted node gets its keys back by replaying it instead of from its peers.
+ * 				Records are gathered in memory by append and written together by commit,
+ * 				once per tick, with at most one fdatasync for all of them (group commit).
+ * 				A record is
+ * 					crc32c of the rest (4 bytes) | length of what follows it (4 bytes) |
+ * 					type (1 byte) | sequence number (8 bytes) | varint key size | key | value
+ * 				with little endian integers. WAL_SET records carry the value the key ended
+ * 				up with, so replaying them in order restores the engine whatever the
+ * 				operation was, and a record applied twice is harmless. Sequence numbers
+ * 				keep growing across truncations, so a snapshot can name the last record it
+ * 				holds and replay skips the ones up to it.
+ */
+class WriteAheadLog {
+private:
+	int fd;
+	string path;
+	// WAL_NO_SYNC, WAL_SYNC_ALWAYS or WAL_SYNC_INTERVAL
+	int policy;
+	// ticks between fdatasyncs of WAL_SYNC_INTERVAL
+	int interval;
+	// records appended since the last commit
+	string buffer;
+	// bytes of whole records in the file
+	off_t size;
+	// sequence number of the last record appended or replayed
+	uint64_t sequence;
+	// written records that no fdatasync has covered yet
+	bool unsynced;
+	long long lastSync;
+	bool writeAll(const char *data, size_t size);
+public:
+	// records, write calls, fdatasyncs and truncations since the log was opened
+	long long records;
+	long long commits;
+	long long syncs;
+	long long truncations;
+	WriteAheadLog();
+	~WriteAheadLog();
+	bool open(const string &path, int policy, int interval);
+	bool isOpen() {
+		return fd >= 0;
+	}
+	void append(walRecordTYPE type, string_view key, string_view value);
+	bool hasPending() {
+		return !buffer.empty();
+	}
+	uint64_t lastSequence() {
+		return sequence;
+	}
+	bool commit(long long now);
+	bool truncate();
+	long long replay(StorageEngine *engine, uint64_t after);
+	void close();
+};
+
+#endif /* _WAL_H_ */
@@ -0,0 +1,315 @@
+/**********************************
+ * FILE NAME: WarmingTable.cpp
+ *
+ * DESCRIPTION: Definition of WarmingTable
+ **********************************/
+
+#include "WarmingTable.h"
+#include "Hash.h"
+
+// Bytes of an unordered_set node besides its string: next pointer, cached hash, malloc
+#define WARMINGTABLE_NODE_OVERHEAD 32
+
+/**
+ * Constructor
+ */
+WarmingTable::WarmingTable(StorageEngine *mem): mem(mem), cold(0), next(0) {}
+
+/**
+ * Destructor
+ */
+WarmingTable::~WarmingTable() {
+	delete mem;
+}
+
+/**
+ * FUNCTION NAME: open
+ *
+ * DESCRIPTION: Map the snapshot at path, every key of which starts cold
+ *
+ * RETURNS:
+ * false if there is no valid snapshot at path
+ */
+bool WarmingTable::open(const string &path) {
+	if ( !snap.open(path) ) {
+		return false;
+	}
+	cold = snap.size();
+	next = 0;
+	return true;
+}
+
+/**
+ * FUNCTION NAME: detach
+ *
+ * DESCRIPTION: Close the snapshot, after which mem holds every pair. A snapshot that
+ * 				failed a checksum is dropped with the keys that were still cold, which the
+ * 				node then gets back from the other replicas like any missing key.
+ */
+void WarmingTable::detach() {
+	if ( snap.isCorrupt() && cold > 0 ) {
+		fprintf(stderr, "WarmingTable: corrupt snapshot, %llu cold keys dropped\n", (unsigned long long)cold);
+	}
+	snap.close();
+	deleted.clear();
+	cold = 0;
+}
+
+/**
+ * FUNCTION NAME: coldValue
+ *
+ * DESCRIPTION: Whether key, known to be absent from mem, is cold, and its value if so
+ */
+bool WarmingTable::coldValue(string_view key, string_view *value) {
+	if ( !snap.isOpen() || (!deleted.empty() && deleted.count(string(key)) != 0) ) {
+		return false;
+	}
+	if ( snap.find(key, value) ) {
+		return true;
+	}
+	if ( snap.isCorrupt() ) {
+		detach();
+	}
+	return false;
+}
+
+/**
+ * FUNCTION NAME: warm
+ *
+ * DESCRIPTION: Move up to budget more snapshot pairs into mem, in key order, skipping the
+ * 				keys that are not cold. The snapshot is closed once no key is cold.
+ *
+ * RETURNS:
+ * true while the snapshot is still open
+ */
+bool WarmingTable::warm(uint64_t budget) {
+	string_view key, value;
+	for ( ; snap.isOpen() && cold > 0 && next < snap.size() && budget > 0; next++, budget-- ) {
+		if ( !snap.entry(next, &key, &value) ) {
+			break;
+		}
+		if ( mem->read(key) == NULL && (deleted.empty() || deleted.count(string(key)) == 0) ) {
+			mem->create(key, string(value));
+			cold--;
+		}
+	}
+	if ( snap.isOpen() && (cold == 0 || next >= snap.size() || snap.isCorrupt()) ) {
+		detach();
+	}
+	return snap.isOpen();
+}
+
+/**
+ * FUNCTION NAME: release
+ *
+ * DESCRIPTION: Hand mem over to the caller once the table is warm. This table is then
+ * 				empty and can be deleted.
+ */
+StorageEngine *WarmingTable::release() {
+	StorageEngine *engine = mem;
+	mem = NULL;
+	return engine;
+}
+
+const char *WarmingTable::name() {
+	return mem->name();
+}
+
+/**
+ * FUNCTION NAME: create
+ *
+ * DESCRIPTION: Insert (key, value) unless the key is in mem or cold
+ */
+const string *WarmingTable::create(string_view key, string value) {
+	string_view v;
+	if ( mem->read(key) != NULL || coldValue(key, &v) ) {
+		return NULL;
+	}
+	if ( !deleted.empty() ) {
+		deleted.erase(string(key));
+	}
+	return mem->create(key, std::move(value));
+}
+
+/**
+ * FUNCTION NAME: createMany
+ *
+ * DESCRIPTION: Insert the pairs whose key is neither in mem nor cold, see
+ * 				StorageEngine::createMany
+ */
+void WarmingTable::createMany(vector<pair<string, string>> &entries) {
+	string_view v;
+	size_t kept = 0;
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		if ( mem->read(entries[i].first) != NULL || coldValue(entries[i].first, &v) ) {
+			continue;
+		}
+		if ( !deleted.empty() ) {
+			deleted.erase(entries[i].first);
+		}
+		if ( kept != i ) {
+			entries[kept] = std::move(entries[i]);
+		}
+		kept++;
+	}
+	entries.resize(kept);
+	mem->createMany(entries);
+}
+
+/**
+ * FUNCTION NAME: read
+ *
+ * DESCRIPTION: The value of key, moving a cold key into mem
+ */
+const string *WarmingTable::read(string_view key) {
+	const string *value = mem->read(key);
+	string_view v;
+	if ( value != NULL || !coldValue(key, &v) ) {
+		return value;
+	}
+	cold--;
+	return mem->create(key, string(v));
+}
+
+/**
+ * FUNCTION NAME: update
+ *
+ * DESCRIPTION: Replace the value of key if it is in mem or cold, see StorageEngine::update
+ */
+const string *WarmingTable::update(string_view key, string newValue, string *oldValue) {
+	string_view v;
+	if ( mem->read(key) != NULL ) {
+		return mem->update(key, std::move(newValue), oldValue);
+	}
+	if ( !coldValue(key, &v) ) {
+		return NULL;
+	}
+	if ( oldValue != NULL ) {
+		*oldValue = string(v);
+	}
+	cold--;
+	return mem->create(key, std::move(newValue));
+}
+
+/**
+ * FUNCTION NAME: upsert
+ *
+ * DESCRIPTION: Set key to value, see StorageEngine::upsert
+ */
+bool WarmingTable::upsert(string_view key, string value, string *oldValue) {
+	string_view v;
+	if ( mem->read(key) != NULL ) {
+		return mem->upsert(key, std::move(value), oldValue);
+	}
+	bool present = coldValue(key, &v);
+	if ( present ) {
+		if ( oldValue != NULL ) {
+			*oldValue = string(v);
+		}
+		cold--;
+	}
+	else if ( !deleted.empty() ) {
+		deleted.erase(string(key));
+	}
+	mem->create(key, std::move(value));
+	return present;
+}
+
+/**
+ * FUNCTION NAME: deleteKey
+ *
+ * DESCRIPTION: Remove key from mem or the snapshot. A snapshot key is remembered in
+ * 				deleted so the snapshot no longer answers for it.
+ */
+bool WarmingTable::deleteKey(string_view key, string *oldValue) {
+	string_view v;
+	if ( mem->deleteKey(key, oldValue) ) {
+		if ( snap.isOpen() && snap.find(key, &v) ) {
+			deleted.insert(string(key));
+		}
+		else if ( snap.isCorrupt() ) {
+			detach();
+		}
+		return true;
+	}
+	if ( !coldValue(key, &v) ) {
+		return false;
+	}
+	if ( oldValue != NULL ) {
+		*oldValue = string(v);
+	}
+	cold--;
+	deleted.insert(string(key));
+	return true;
+}
+
+/**
+ * FUNCTION NAME: forEach
+ *
+ * DESCRIPTION: Visit the pairs of mem, then the cold pairs in key order. Cold pairs are
+ * 				copied out of the snapshot for the visit.
+ */
+void WarmingTable::forEach(const visitor &visit) {
+	mem->forEach(visit);
+	string_view key, value;
+	for ( uint64_t i = 0; snap.isOpen() && i < snap.size(); i++ ) {
+		if ( !snap.entry(i, &key, &value) ) {
+			break;
+		}
+		if ( mem->read(key) == NULL && (deleted.empty() || deleted.count(string(key)) == 0) ) {
+			visit(string(key), string(value));
+		}
+	}
+	if ( snap.isCorrupt() ) {
+		detach();
+	}
+}
+
+/**
+ * FUNCTION NAME: forEachInRange
+ *
+ * DESCRIPTION: See StorageEngine::forEachInRange. While keys are cold the pairs in range
+ * 				are copied, since forEach only lends cold pairs for the visit.
+ */
+void WarmingTable::forEachInRange(uint64_t from, uint64_t to, bool ordered, const visitor &visit) {
+	if ( !snap.isOpen() ) {
+		mem->forEachInRange(from, to, ordered, visit);
+		return;
+	}
+	vector<tuple<uint64_t, string, string>> found;
+	forEach([&](const string &key, const string &value) {
+		uint64_t token = hash64(key);
+		if ( inRange(token, from, to) ) {
+			found.emplace_back(token - from - 1, key, value);
+		}
+	});
+	if ( ordered ) {
+		sort(found.begin(), found.end());
+	}
+	for ( auto &f : found ) {
+		visit(get<1>(f), get<2>(f));
+	}
+}
+
+unsigned long WarmingTable::currentSize() {
+	return mem->currentSize() + cold;
+}
+
+/**
+ * FUNCTION NAME: memoryUsage
+ *
+ * DESCRIPTION: Bytes of mem and of the deleted keys. The mapped snapshot is page cache
+ * 				and not counted.
+ */
+size_t WarmingTable::memoryUsage() {
+	size_t bytes = mem->memoryUsage();
+	for ( auto &key : deleted ) {
+		bytes += sizeof(string) + WARMINGTABLE_NODE_OVERHEAD + stringBytes(key);
+	}
+	return bytes;
+}
+
+void WarmingTable::clear() {
+	mem->clear();
+	detach();
+}
@@ -0,0 +1,68 @@
+/**********************************
+ * FILE NAME: WarmingTable.h
+ *
+ * DESCRIPTION: Storage engine warming up from a snapshot file, header file
+ **********************************/
+
+#ifndef WARMINGTABLE_H_
+#define WARMINGTABLE_H_
+
+#include "stdincludes.h"
+#include "StorageEngine.h"
+#include "Snapshot.h"
+#include <unordered_set>
+
+/**
+ * CLASS NAME: WarmingTable
+ *
+ * DESCRIPTION: Storage engine a restarted node uses while its snapshot is loaded. Writes
+ * 				and warmed pairs go to an in-memory engine, and the pairs it does not hold
+ * 				are read from the mapped snapshot, so the node serves every key right away.
+ * 				Each snapshot key is either cold, only in the snapshot, or has moved to the
+ * 				engine, or was deleted and is then kept in deleted. A read moves the key it
+ * 				finds into the engine and warm moves the rest a batch at a time. Once no key
+ * 				is cold the snapshot is closed and release hands the engine back.
+ */
+class WarmingTable : public StorageEngine {
+private:
+	StorageEngine *mem;
+	SnapshotFile snap;
+	// snapshot keys deleted since it was opened, never held by mem
+	unordered_set<string> deleted;
+	// snapshot keys that are neither in mem nor deleted
+	uint64_t cold;
+	// next snapshot pair warm looks at
+	uint64_t next;
+	bool coldValue(string_view key, string_view *value);
+	void detach();
+public:
+	WarmingTable(StorageEngine *mem);
+	~WarmingTable();
+	bool open(const string &path);
+	uint64_t snapshotSize() {
+		return snap.size();
+	}
+	uint64_t snapshotSequence() {
+		return snap.walSequence();
+	}
+	bool warm(uint64_t budget);
+	bool isWarm() {
+		return !snap.isOpen();
+	}
+	StorageEngine *release();
+
+	const char *name();
+	const string *create(string_view key, string value);
+	void createMany(vector<pair<string, string>> &entries);
+	const string *read(string_view key);
+	const string *update(string_view key, string newValue, string *oldValue = NULL);
+	bool upsert(string_view key, string value, string *oldValue = NULL);
+	bool deleteKey(string_view key, string *oldValue = NULL);
+	void forEach(const visitor &visit);
+	void forEachInRange(uint64_t from, uint64_t to, bool ordered, const visitor &visit);
+	unsigned long currentSize();
+	size_t memoryUsage();
+	void clear();
+};
+
+#endif /* WARMINGTABLE_H_ */
@@ -0,0 +1,119 @@
+/**********************************
+ * FILE NAME: WorkerPool.cpp
+ *
+ * DESCRIPTION: Work stealing thread pool definition
+ **********************************/
+
+#include "WorkerPool.h"
+
+/**
+ * Constructor
+ */
+WorkerPool::WorkerPool(int nworkers) {
+	this->nworkers = nworkers < 1 ? 1 : nworkers;
+	ranges = new worker_range[this->nworkers];
+	task = NULL;
+	generation = 0;
+	busy = 0;
+	stopping = false;
+	for ( int w = 1; w < this->nworkers; w++ ) {
+		threads.push_back(thread(&WorkerPool::workerMain, this, w));
+	}
+}
+
+/**
+ * Destructor
+ */
+WorkerPool::~WorkerPool() {
+	{
+		unique_lock<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for ( size_t i = 0; i < threads.size(); i++ ) {
+		threads[i].join();
+	}
+	delete [] ranges;
+}
+
+/**
+ * FUNCTION NAME: workerMain
+ *
+ * DESCRIPTION: Body of the pool threads, sleep until a loop is posted and run it
+ */
+void WorkerPool::workerMain(int w) {
+	unsigned long seen = 0;
+
+	while ( true ) {
+		{
+			unique_lock<mutex> guard(lock);
+			while ( !stopping && generation == seen ) {
+				wake.wait(guard);
+			}
+			if ( stopping ) {
+				return;
+			}
+			seen = generation;
+		}
+
+		runWorker(w);
+
+		{
+			unique_lock<mutex> guard(lock);
+			if ( --busy == 0 ) {
+				done.notify_one();
+			}
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: runWorker
+ *
+ * DESCRIPTION: Drain worker w's own range, then steal from the others in turn
+ */
+void WorkerPool::runWorker(int w) {
+	int i;
+
+	for ( int k = 0; k < nworkers; k++ ) {
+		worker_range &r = ranges[(w + k) % nworkers];
+		while ( (i = r.next.fetch_add(1, memory_order_relaxed)) < r.end ) {
+			(*task)(i);
+		}
+	}
+}
+
+/**
+ * FUNCTION NAME: parallelFor
+ *
+ * DESCRIPTION: Call fn(i) for every i in [0, n) across the pool and wait for all of them
+ */
+void WorkerPool::parallelFor(int n, const function<void(int)> &fn) {
+	if ( nworkers == 1 || n <= 1 ) {
+		for ( int i = 0; i < n; i++ ) {
+			fn(i);
+		}
+		return;
+	}
+
+	// Contiguous slices, so a worker keeps touching the same nodes tick after tick
+	for ( int w = 0; w < nworkers; w++ ) {
+		ranges[w].next.store((int)((long long)n * w / nworkers), memory_order_relaxed);
+		ranges[w].end = (int)((long long)n * (w + 1) / nworkers);
+	}
+	{
+		unique_lock<mutex> guard(lock);
+		task = &fn;
+		busy = nworkers - 1;
+		generation++;
+	}
+	wake.notify_all();
+
+	runWorker(0);
+
+	unique_lock<mutex> guard(lock);
+	while ( busy > 0 ) {
+		done.wait(guard);
+	}
+	task = NULL;
+}
@@ -0,0 +1,56 @@
+/**********************************
+ * FILE NAME: WorkerPool.h
+ *
+ * DESCRIPTION: Work stealing thread pool header file
+ **********************************/
+
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+
+#include "stdincludes.h"
+
+/**
+ * Struct Name: worker_range
+ *
+ * DESCRIPTION: Indices owned by one worker. The owner and thieves both claim
+ * 				from next, so an index is handed out exactly once.
+ */
+typedef struct alignas(64) worker_range {
+	atomic<int> next;
+	int end;
+}worker_range;
+
+/**
+ * CLASS NAME: WorkerPool
+ *
+ * DESCRIPTION: Fixed set of threads running parallel for loops. The calling thread
+ * 				takes part as worker 0, and parallelFor returns only when every index
+ * 				has been processed, which makes each call a barrier.
+ */
+class WorkerPool {
+private:
+	int nworkers;
+	vector<thread> threads;
+	worker_range *ranges;
+	const function<void(int)> *task;
+	mutex lock;
+	condition_variable wake;
+	condition_variable done;
+	// Bumped once per parallelFor so sleeping workers know there is new work
+	unsigned long generation;
+	int busy;
+	bool stopping;
+	void workerMain(int w);
+	void runWorker(int w);
+public:
+	WorkerPool(int nworkers);
+	WorkerPool(const WorkerPool &anotherPool) = delete;
+	WorkerPool& operator = (const WorkerPool &anotherPool) = delete;
+	virtual ~WorkerPool();
+	int size() {
+		return nworkers;
+	}
+	void parallelFor(int n, const function<void(int)> &fn);
+};
+
+#endif /* _WORKERPOOL_H_ */
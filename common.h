@@ -1,14 +1,17 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <atomic>
+
 /**
  * Global variable
  */
 // Transaction Id
-static int g_transID = 0;
+static std::atomic<int> g_transID(0);
 
-// message types, reply is the message from node to coordinator
-enum MessageType {CREATE, READ, UPDATE, DELETE, REPLY, READREPLY};
+// message types, reply is the message from node to coordinator, sync is anti-entropy between replicas,
+// bulk carries a chunk of keys to a new replica and bulkack acknowledges it
+enum MessageType {CREATE, READ, UPDATE, DELETE, REPLY, READREPLY, SYNC, BULK, BULKACK};
 // enum of replica types
 enum ReplicaType {PRIMARY, SECONDARY, TERTIARY};
 
@@ -10,7 +10,6 @@
 /*
  * Macros
  */
-#define RING_SIZE 512
 #define FAILURE -1
 #define SUCCESS 0
 
@@ -31,10 +30,18 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <queue>
 #include <fstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 using namespace std;
 